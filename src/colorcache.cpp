@@ -0,0 +1,264 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "colorcache.h"
+
+#define OFFSET(TYPE, MEMBER) ((size_t)(&(((TYPE *)0)->MEMBER)))
+#define HASH_SIZE 4096
+
+u32 ColorCache::mHits = 0;
+u32 ColorCache::mMisses = 0;
+u32 ColorCache::mDrops = 0;
+
+ColorCache::ColorCache(u32 maxBytes)
+{
+	mMaxBytes = maxBytes;
+	mBytes = 0;
+
+	mTable = new Entry *[HASH_SIZE];
+	memset(mTable, 0, sizeof(Entry *) * HASH_SIZE);
+
+	mLru.prev = mLru.next = &mLru;
+}
+
+ColorCache::~ColorCache()
+{
+	flush();
+	delete[] mTable;
+}
+
+u32 ColorCache::hash(u32 code, u32 attr)
+{
+	return ((code * 2654435761U) ^ (attr * 40503U)) % HASH_SIZE;
+}
+
+u8 *ColorCache::find(u32 code, u32 attr)
+{
+	Entry *entry = mTable[hash(code, attr)];
+	for (; entry; entry = entry->hnext) {
+		if (entry->code == code && entry->attr == attr) break;
+	}
+
+	if (!entry) {
+		mMisses++;
+		return 0;
+	}
+
+	mHits++;
+
+	// move to the head of lru list
+	unlink(entry);
+	entry->next = mLru.next;
+	entry->prev = &mLru;
+	mLru.next->prev = entry;
+	mLru.next = entry;
+
+	return entry->pixels;
+}
+
+u8 *ColorCache::add(u32 code, u32 attr, u32 size)
+{
+	if (size > mMaxBytes) return 0;
+
+	while (mBytes + size > mMaxBytes) {
+		remove(mLru.prev);
+		mDrops++;
+	}
+
+	Entry *entry = (Entry *)new u8[OFFSET(Entry, pixels) + size];
+	entry->code = code;
+	entry->attr = attr;
+	entry->size = size;
+
+	Entry **head = &mTable[hash(code, attr)];
+	entry->hnext = *head;
+	*head = entry;
+
+	entry->next = mLru.next;
+	entry->prev = &mLru;
+	mLru.next->prev = entry;
+	mLru.next = entry;
+
+	mBytes += size;
+	return entry->pixels;
+}
+
+void ColorCache::flush()
+{
+	while (mLru.next != &mLru) {
+		remove(mLru.next);
+	}
+}
+
+void ColorCache::unlink(Entry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+void ColorCache::remove(Entry *entry)
+{
+	unlink(entry);
+
+	Entry **cur = &mTable[hash(entry->code, entry->attr)];
+	while (*cur != entry) cur = &(*cur)->hnext;
+	*cur = entry->hnext;
+
+	mBytes -= entry->size;
+	delete[] (u8 *)entry;
+}
+
+void ColorCache::showStats(bool verbose)
+{
+	if (!verbose || !(mHits + mMisses)) return;
+
+	printf("[screen] color cache hits: %u, misses: %u (%u%% hit), dropped: %u\n",
+		mHits, mMisses, (u32)(mHits * 100ULL / (mHits + mMisses)), mDrops);
+}
+
+u32 BlendTables::mHits = 0;
+u32 BlendTables::mMisses = 0;
+
+BlendTables::BlendTables()
+{
+	flush();
+}
+
+u32 *BlendTables::find(u32 pair)
+{
+	for (u32 i = 0; i < mNum; i++) {
+		if (mTables[i].pair == pair) {
+			mHits++;
+			mTables[i].used = ++mClock;
+			return mTables[i].pixels;
+		}
+	}
+
+	mMisses++;
+	return 0;
+}
+
+u32 *BlendTables::add(u32 pair)
+{
+	u32 slot = mNum;
+
+	if (mNum < NR_TABLES) mNum++;
+	else {
+		slot = 0;
+		for (u32 i = 1; i < NR_TABLES; i++) {
+			if (mTables[i].used < mTables[slot].used) slot = i;
+		}
+	}
+
+	mTables[slot].pair = pair;
+	mTables[slot].used = ++mClock;
+	return mTables[slot].pixels;
+}
+
+const u32 *BlendTables::peek(u32 pair)
+{
+	for (u32 i = 0; i < mNum; i++) {
+		if (mTables[i].pair == pair) return mTables[i].pixels;
+	}
+
+	return 0;
+}
+
+void BlendTables::flush()
+{
+	mNum = 0;
+	mClock = 0;
+}
+
+void BlendTables::showStats(bool verbose)
+{
+	if (!verbose || !(mHits + mMisses)) return;
+
+	printf("[screen] blend table hits: %u, misses: %u (%u%% hit)\n",
+		mHits, mMisses, (u32)(mHits * 100ULL / (mHits + mMisses)));
+}
+
+u32 LineCache::mHits = 0;
+u32 LineCache::mMisses = 0;
+
+LineCache::LineCache(u32 maxBytes, u32 rowBytes)
+{
+	mRowBytes = rowBytes;
+	mRows = rowBytes ? (maxBytes / rowBytes) : 0;
+
+	mIndex = new Row[mRows];
+	mPixels = new u8[mRows * mRowBytes];
+	flush();
+}
+
+LineCache::~LineCache()
+{
+	delete[] mIndex;
+	delete[] mPixels;
+}
+
+u8 *LineCache::find(u32 line, u32 generation)
+{
+	for (u32 i = 0; i < mNum; i++) {
+		if (mIndex[i].line == line && mIndex[i].generation == generation) {
+			mHits++;
+			mIndex[i].used = ++mClock;
+			return mPixels + i * mRowBytes;
+		}
+	}
+
+	mMisses++;
+	return 0;
+}
+
+u8 *LineCache::add(u32 line, u32 generation)
+{
+	if (!mRows) return 0;
+	u32 slot = mNum;
+
+	if (mNum < mRows) mNum++;
+	else {
+		slot = 0;
+		for (u32 i = 1; i < mRows; i++) {
+			if (mIndex[i].used < mIndex[slot].used) slot = i;
+		}
+	}
+
+	mIndex[slot].line = line;
+	mIndex[slot].generation = generation;
+	mIndex[slot].used = ++mClock;
+	return mPixels + slot * mRowBytes;
+}
+
+void LineCache::flush()
+{
+	mNum = 0;
+	mClock = 0;
+}
+
+void LineCache::showStats(bool verbose)
+{
+	if (!verbose || !(mHits + mMisses)) return;
+
+	printf("[screen] history row cache hits: %u, misses: %u (%u%% hit)\n",
+		mHits, mMisses, (u32)(mHits * 100ULL / (mHits + mMisses)));
+}
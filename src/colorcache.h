@@ -0,0 +1,112 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef COLORCACHE_H
+#define COLORCACHE_H
+
+#include "type.h"
+
+// glyphs already rendered in screen pixel format, least recently used ones are dropped first
+class ColorCache {
+public:
+	ColorCache(u32 maxBytes);
+	~ColorCache();
+
+	u8 *find(u32 code, u32 attr);
+	u8 *add(u32 code, u32 attr, u32 size);
+	void flush();
+	u32 maxBytes() { return mMaxBytes; }
+
+	static void showStats(bool verbose);
+
+private:
+	struct Entry {
+		Entry *prev, *next;
+		Entry *hnext;
+		u32 code, attr, size;
+		u8 pixels[0];
+	};
+
+	u32 hash(u32 code, u32 attr);
+	void unlink(Entry *entry);
+	void remove(Entry *entry);
+
+	Entry **mTable;
+	Entry mLru;
+	u32 mMaxBytes, mBytes;
+
+	static u32 mHits, mMisses, mDrops;
+};
+
+// 256 entry tables mapping glyph coverage to the screen pixel blended between a pair of colors,
+// for the few color pairs in use at a time
+class BlendTables {
+public:
+	BlendTables();
+
+	u32 *find(u32 pair);
+	u32 *add(u32 pair);
+	// lookup for the render threads, leaves the lru order and counters alone
+	const u32 *peek(u32 pair);
+	void flush();
+
+	static void showStats(bool verbose);
+
+private:
+	enum { NR_TABLES = 16 };
+
+	struct Table {
+		u32 pair, used;
+		u32 pixels[256];
+	};
+
+	Table mTables[NR_TABLES];
+	u32 mNum, mClock;
+
+	static u32 mHits, mMisses;
+};
+
+// rows of text already rendered, all of the same size, so that paging through history copies them
+// back instead of drawing them again
+class LineCache {
+public:
+	LineCache(u32 maxBytes, u32 rowBytes);
+	~LineCache();
+
+	u8 *find(u32 line, u32 generation);
+	u8 *add(u32 line, u32 generation);
+	void flush();
+	u32 rows() { return mRows; }
+
+	static void showStats(bool verbose);
+
+private:
+	struct Row {
+		u32 line, generation, used;
+	};
+
+	Row *mIndex;
+	u8 *mPixels;
+	u32 mRows, mRowBytes, mNum, mClock;
+
+	static u32 mHits, mMisses;
+};
+
+#endif
@@ -117,6 +117,14 @@ void Config::getOption(const s8 *key, bool &val)
 	else if (!strcmp(entry->val, "no")) val = false;
 }
 
+void Config::setOption(const s8 *key, const s8 *val)
+{
+	OptionEntry *entry = getEntry(key);
+
+	if (entry) entry->val = val;
+	else addEntry(key, val);
+}
+
 Config::OptionEntry *Config::getEntry(const s8 *key)
 {
 	if (!key) return 0;
@@ -207,6 +215,59 @@ void Config::checkConfigFile(const s8 *name)
 		"\n"
 		"# treat ambiguous width characters as wide\n"
 		"#ambiguous-wide=yes\n"
+		"\n"
+		"# memory in KB used to keep glyph bitmaps, the least recently used ones are dropped beyond it,\n"
+		"# 0 means no limit\n"
+		"glyph-cache-size=4096\n"
+		"\n"
+		"# keep the glyphs drawn in a file under $XDG_CACHE_HOME/fbterm, so that they needn't be rendered\n"
+		"# again the next time fbterm starts with the same fonts, size and rotation\n"
+		"#glyph-cache-file=yes\n"
+		"\n"
+		"# memory in KB used to keep glyphs already drawn with their colors, 0 means disable it\n"
+		"color-cache-size=2048\n"
+		"\n"
+		"# memory in KB used to keep history lines already drawn, so that paging back and forth through\n"
+		"# history copies them instead of drawing them again, about twice the screen size keeps two pages,\n"
+		"# 0 means disable it, only used with a shadow buffer and without a background image\n"
+		"#history-cache-size=16384\n"
+		"\n"
+		"# keep glyph bitmaps padded to whole cells, so that drawing a glyph needs no clipping or background\n"
+		"# fills around it, at the cost of more memory, see the glyph statistics of --verbose\n"
+		"#pad-glyphs=yes\n"
+		"\n"
+		"# draw box drawing, block element and braille characters to fill whole cells instead of taking\n"
+		"# them from the fonts, so that they join up seamlessly\n"
+		"draw-box-glyphs=yes\n"
+		"\n"
+		"# draw into a copy of video memory in system memory, changed areas are copied to video memory later\n"
+		"# mostly helps video cards without write-combining, also lets scrolling copy pixels instead of redrawing\n"
+		"#shadow-buffer=yes\n"
+		"\n"
+		"# draw the next frame into the hidden half of a virtual screen twice as tall as the visible one,\n"
+		"# then show it at once to avoid tearing, see 'fbset -vyres'. implies shadow-buffer, disables hardware scrolling\n"
+		"#page-flip=yes\n"
+		"\n"
+		"# with screen-rotate=1 or 3, draw the screen unrotated and rotate the changed areas while copying them\n"
+		"# to video memory. implies shadow-buffer, disables hardware scrolling\n"
+		"#rotate-on-flush=yes\n"
+		"\n"
+		"# redraw the screen at most this many times per second while a program is writing output quickly\n"
+		"# 0 means redraw after every read\n"
+		"max-fps=60\n"
+		"\n"
+		"# number of threads drawing large screen updates, each one takes a band of text rows\n"
+		"#render-threads=4\n"
+		"\n"
+		"# limit text rendering to the kernels of an instruction set: no, sse2 or avx2\n"
+		"#render-simd=sse2\n"
+		"\n"
+		"# draw into system memory instead of a frame buffer device, for running without a display,\n"
+		"# the value is WIDTHxHEIGHTxBPP. the screen is written to the PPM image FRAMEBUFFER names on exit\n"
+		"#mem-screen=1024x768x32\n"
+		"\n"
+		"# pan the memory screen as a frame buffer device would: ypan or ywrap, or xpan with screen-rotate=1 or 3\n"
+		"#mem-screen-pan=ywrap\n"
 		;
 
 	struct stat cstat;
@@ -237,6 +298,8 @@ bool Config::parseArgs(s32 argc, s8 **argv)
 		{ "font-width", required_argument, 0, 2 },
 		{ "font-height", required_argument, 0, 4 },
 		{ "ambiguous-wide", no_argument, 0, 'a' },
+		{ "mem-screen", required_argument, 0, 5 },
+		{ "render-check", no_argument, 0, 6 },
 #ifdef ENABLE_VESA
 		{ "vesa-mode", required_argument, 0, 3 },
 #endif
@@ -271,6 +334,8 @@ bool Config::parseArgs(s32 argc, s8 **argv)
 				"  -i, --input-method=TEXT         specify input method program\n"
 				"      --cursor-shape=NUM          specify default cursor shape\n"
 				"      --cursor-interval=NUM       specify cursor flash interval\n"
+				"      --mem-screen=WxHxBPP        draw into system memory instead of a frame buffer\n"
+				"      --render-check              compare the optimized rendering paths with the plain one\n"
 #ifdef ENABLE_VESA
 				"      --vesa-mode=NUM             force VESA video mode\n"
 				"                  list            display available VESA video modes\n"
@@ -284,12 +349,7 @@ bool Config::parseArgs(s32 argc, s8 **argv)
 			for (const option *opt = options; opt->name; opt++) {
 				if (opt->val != index) continue;
 
-				const s8 *val  = (opt->has_arg ? optarg : "yes");
-				OptionEntry *entry = getEntry(opt->name);
-
-				if (entry) entry->val = val;
-				else addEntry(opt->name, val);
-
+				setOption(opt->name, opt->has_arg ? optarg : "yes");
 				break;
 			}
 			break;
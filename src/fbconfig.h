@@ -30,6 +30,8 @@ public:
 	void getOption(const s8 *key, s8 *val, u32 len);
 	void getOption(const s8 *key, u32 &val);
 	void getOption(const s8 *key, bool &val);
+	// key and val are kept, not copied
+	void setOption(const s8 *key, const s8 *val);
 	bool parseArgs(s32 argc, s8 **argv);
 	s8** getShellCommand() { return mShellCommand; }
 
@@ -28,6 +28,7 @@
 #include <linux/fb.h>
 #include "fbdev.h"
 #include "font.h"
+#include "fbconfig.h"
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -72,15 +73,21 @@ FbDev *FbDev::initFbDev()
 
 	case 15:
 	case 16:
+	case 24:
 	case 32:
 		if (finfo.visual != FB_VISUAL_TRUECOLOR && finfo.visual != FB_VISUAL_DIRECTCOLOR) {
-			fprintf(stderr, "only support true-color/direct-color visual with 15/16/32bpp depth!\n");
+			fprintf(stderr, "only support true-color/direct-color visual with 15/16/24/32bpp depth!\n");
+			return 0;
+		}
+		if (!vinfo.red.length || !vinfo.green.length || !vinfo.blue.length
+			|| vinfo.red.length > 16 || vinfo.green.length > 16 || vinfo.blue.length > 16) {
+			fprintf(stderr, "unsupported pixel format of frame buffer device!\n");
 			return 0;
 		}
 		break;
 
 	default:
-		fprintf(stderr, "only support frame buffer device with 8/15/16/32 color depth!\n");
+		fprintf(stderr, "only support frame buffer device with 8/15/16/24/32 color depth!\n");
 		return 0;
 	}
 
@@ -93,8 +100,31 @@ FbDev::FbDev()
 	mHeight = vinfo.yres;
 	mBitsPerPixel = vinfo.bits_per_pixel;
 	mBytesPerLine = finfo.line_length;
+
+	mLayout.red.offset = vinfo.red.offset;
+	mLayout.red.length = vinfo.red.length;
+	mLayout.green.offset = vinfo.green.offset;
+	mLayout.green.length = vinfo.green.length;
+	mLayout.blue.offset = vinfo.blue.offset;
+	mLayout.blue.length = vinfo.blue.length;
 	mVMemBase = (u8 *)mmap(0, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fbdev_fd, 0);
 
+	bool pageflip = false;
+	Config::instance()->getOption("page-flip", pageflip);
+
+	if (pageflip && vinfo.yres_virtual >= vinfo.yres * 2 && finfo.smem_len >= vinfo.yres * 2 * finfo.line_length
+		&& finfo.ypanstep && !(vinfo.yres % finfo.ypanstep)) {
+		vinfo.yoffset = vinfo.yres;
+		bool ok = !ioctl(fbdev_fd, FBIOPAN_DISPLAY, &vinfo);
+
+		vinfo.yoffset = 0;
+		ioctl(fbdev_fd, FBIOPAN_DISPLAY, &vinfo);
+
+		if (ok) {
+			mPageLines = vinfo.yres;
+			return;
+		}
+	}
 
 	if (mRotateType == Rotate0 || mRotateType == Rotate180) {
 		bool ypan = (vinfo.yres_virtual > vinfo.yres && finfo.ypanstep && !(FH(1) % finfo.ypanstep));
@@ -122,7 +152,7 @@ FbDev::~FbDev()
 	munmap(mVMemBase, finfo.smem_len);
 	close(fbdev_fd);
 
-	if (mScrollType != Redraw) {
+	if (mScrollType != Redraw || mPageLines) {
 		ioctl(STDIN_FILENO, KDSETMODE, KD_GRAPHICS);
 		ioctl(STDIN_FILENO, KDSETMODE, KD_TEXT);
 	}
@@ -135,7 +165,7 @@ const s8 *FbDev::drvId()
 
 void FbDev::setupOffset()
 {
-	vinfo.yoffset = mOffsetCur;
+	vinfo.yoffset = mOffsetCur + mFrontPage * mPageLines;
 	ioctl(fbdev_fd, FBIOPAN_DISPLAY, &vinfo);
 }
 
@@ -39,6 +39,9 @@
 #define screen (Screen::instance())
 #define manager (FbShellManager::instance())
 
+// overlays of the screen, see Screen::overlayText()
+enum { CursorOverlay = 0, PointerOverlay };
+
 static const Color defaultPalette[NR_COLORS] = {
 	{0x00, 0x00, 0x00}, /* 0 */
 	{0xaa, 0x00, 0x00}, /* 1 */
@@ -306,6 +309,7 @@ static const Color defaultPalette[NR_COLORS] = {
 };
 
 static bool firstShell = true;
+u32 FbShell::mCellsDrawn = 0, FbShell::mCellsSkipped = 0;
 
 u16 VTerm::init_history_lines()
 {
@@ -349,9 +353,13 @@ FbShell::FbShell()
 	mImProxy = 0;
 	mPaletteChanged = false;
 	mPalette = 0;
+	mGlass = 0;
 	createShellProcess(Config::instance()->getShellCommand());
 	resize(screen->cols(), screen->rows());
 
+	mGlass = new GlassCell[w() * h()];
+	invalidateGlass(0, 0, w(), h());
+
 	firstShell = false;
 }
 
@@ -361,25 +369,177 @@ FbShell::~FbShell()
 
 	manager->shellExited(this);
 	if (mPalette) delete[] mPalette;
+	if (mGlass) delete[] mGlass;
 }
 
 void FbShell::drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws)
 {
-	if (manager->activeShell() != this) return;
+	CharAttr attrs[num];
+	for (u16 i = 0; i < num; i++) {
+		attrs[i] = attr;
+	}
+
+	drawLine(x, y, num, chars, dws, attrs);
+}
+
+void FbShell::drawLine(u16 x, u16 y, u16 num, u16 *chars, bool *dws, CharAttr *attrs)
+{
+	if (manager->activeShell() != this) {
+		manager->shellChanged();
+		return;
+	}
+
+	if (!num) return;
 
+	// whole lines of history are kept rendered when there is a history row cache
+	u32 line, generation;
+	bool history = historyLine(x, y, num, dws, line, generation);
+
+	CharAttr attr = attrs[0], last = attr;
 	adjustCharAttr(attr);
-	screen->drawText(FW(x), FH(y), attr.fcolor, attr.bcolor, num, chars, dws);
 
-	if (mImProxy) {
+	if (history && screen->drawCachedRow(FH(y), line, generation)) {
+		for (u16 i = 0; i < num; x += dws[i] ? 2 : 1, i++) {
+			if (attrs[i] != last) {
+				last = attr = attrs[i];
+				adjustCharAttr(attr);
+			}
+			updateGlass(attr, x, y, chars[i], dws[i]);
+		}
+		return;
+	}
+
+	u8 fcs[num], bcs[num];
+
+	u16 start = 0, startx = x;
+	for (u16 i = 0; i < num; x += dws[i] ? 2 : 1, i++) {
+		if (attrs[i] != last) {
+			last = attr = attrs[i];
+			adjustCharAttr(attr);
+		}
+
+		fcs[i] = attr.fcolor;
+		bcs[i] = attr.bcolor;
+
+		if (updateGlass(attr, x, y, chars[i], dws[i])) {
+			mCellsDrawn += dws[i] ? 2 : 1;
+			continue;
+		}
+
+		mCellsSkipped += dws[i] ? 2 : 1;
+		if (start < i) drawSpan(startx, y, i - start, chars + start, dws + start, fcs + start, bcs + start);
+
+		start = i + 1;
+		startx = x + (dws[i] ? 2 : 1);
+	}
+
+	if (start < num) drawSpan(startx, y, num - start, chars + start, dws + start, fcs + start, bcs + start);
+	if (history) screen->cacheRow(FH(y), line, generation);
+}
+
+void FbShell::drawSpan(u16 x, u16 y, u16 num, u16 *chars, bool *dws, u8 *fcs, u8 *bcs)
+{
+	// cells under the input method windows are skipped, only those on their edges draw over them
+	if (screen->drawRow(FW(x), FH(y), num, chars, dws, fcs, bcs) && mImProxy) {
+		u16 w = 0;
+		for (u16 i = 0; i < num; i++) {
+			w += dws[i] ? 2 : 1;
+		}
+
 		Rectangle rect = { FW(x), FH(y), FW(w), FH(1) };
-		mImProxy->redrawImWin(rect);
+		mImProxy->damageImWin(rect);
+	}
+}
+
+void FbShell::redrawImWin()
+{
+	if (mImProxy) mImProxy->redrawImWin();
+}
+
+bool FbShell::updateGlass(CharAttr attr, u16 x, u16 y, u16 code, bool dw)
+{
+	if (!mGlass || x + dw >= w() || y >= h()) return true;
+
+	GlassCell *cell = mGlass + y * w() + x;
+	bool changed = (cell->code != code || cell->attr != attr || cell->attr.type != (dw ? CharAttr::DoubleLeft : CharAttr::Single));
+
+	if (dw) {
+		changed = changed || (cell[1].code != code || cell[1].attr != attr || cell[1].attr.type != CharAttr::DoubleRight);
+	}
+
+	if (changed) {
+		cell->code = code;
+		cell->attr = attr;
+		cell->attr.type = (dw ? CharAttr::DoubleLeft : CharAttr::Single);
+
+		if (dw) {
+			cell[1].code = code;
+			cell[1].attr = attr;
+			cell[1].attr.type = CharAttr::DoubleRight;
+		}
+	}
+
+	return changed;
+}
+
+void FbShell::invalidateGlass(u16 x, u16 y, u16 w, u16 h)
+{
+	if (!mGlass || x >= this->w() || y >= this->h()) return;
+	if (x + w > this->w()) w = this->w() - x;
+	if (y + h > this->h()) h = this->h() - y;
+
+	for (; h--; y++) {
+		GlassCell *cell = mGlass + y * this->w() + x;
+		for (u16 i = w; i--; cell++) {
+			cell->attr.type = 3; // never matches a drawn cell
+		}
+	}
+}
+
+void FbShell::moveGlass(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h, bool moved)
+{
+	if (!mGlass || sx != dx || sx + w > this->w() || sy + h > this->h() || dy + h > this->h()) {
+		invalidateGlass(0, 0, this->w(), this->h());
+		return;
+	}
+
+	u16 top = (sy < dy ? sy : dy), bot = (sy > dy ? sy : dy) + h;
+
+	// when screen->move() fails, the area may have been scrolled anyway before being given up
+	if (!moved) {
+		invalidateGlass(sx, top, w, bot - top);
+		return;
+	}
+
+	u32 cols = this->w();
+	if (sy > dy) {
+		for (u16 i = 0; i < h; i++) {
+			memmove(mGlass + (dy + i) * cols + dx, mGlass + (sy + i) * cols + sx, w * sizeof(GlassCell));
+		}
+		invalidateGlass(sx, dy + h, w, bot - dy - h);
+	} else {
+		for (u16 i = h; i--;) {
+			memmove(mGlass + (dy + i) * cols + dx, mGlass + (sy + i) * cols + sx, w * sizeof(GlassCell));
+		}
+		invalidateGlass(sx, top, w, dy - top);
 	}
 }
 
 bool FbShell::moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h)
 {
-	if (manager->activeShell() != this) return true;
-	return screen->move(sx, sy, dx, dy, w, h);
+	if (manager->activeShell() != this) {
+		manager->shellChanged();
+		return true;
+	}
+
+	bool moved = screen->move(sx, sy, dx, dy, w, h);
+	moveGlass(sx, sy, dx, dy, w, h, moved);
+	return moved;
+}
+
+bool FbShell::deferUpdate()
+{
+	return manager->activeShell() == this && manager->deferFrame();
 }
 
 void FbShell::drawCursor(CharAttr attr, u16 x, u16 y, u16 c)
@@ -393,6 +553,8 @@ void FbShell::drawCursor(CharAttr attr, u16 x, u16 y, u16 c)
 	mCursor.code = c;
 	mCursor.showed = false;
 
+	if (manager->activeShell() != this) manager->shellChanged();
+
 	updateCursor();
 
 	if (manager->activeShell() == this && (oldX != x || oldY != y)) {
@@ -420,35 +582,29 @@ void FbShell::updateCursor()
 		shape = default_shape;
 	}
 
-	switch (shape) {
-	case CurNone:
-		break;
+	// the cursor is an overlay, blinking it off puts back the pixels saved from under it
+	if (!mCursor.showed || shape == CurNone) {
+		screen->hideOverlay(CursorOverlay);
+		return;
+	}
 
-	case CurUnderline:
-		screen->fillRect(FW(mCursor.x), FH(mCursor.y + 1) - 1, FW(1), 1, mCursor.showed ? mCursor.attr.fcolor : mCursor.attr.bcolor);
-		if (mImProxy) {
-			Rectangle rect = { FW(mCursor.x), FH(mCursor.y + 1) - 1, FW(1), 1 };
-			mImProxy->redrawImWin(rect);
-		}
-		break;
+	if (shape == CurUnderline) {
+		screen->overlayRect(CursorOverlay, FW(mCursor.x), FH(mCursor.y + 1) - 1, FW(1), 1, mCursor.attr.fcolor);
+		return;
+	}
 
-	default: {
-		bool dw = (mCursor.attr.type != CharAttr::Single);
+	bool dw = (mCursor.attr.type != CharAttr::Single);
 
-		u16 x = mCursor.x;
-		if (mCursor.attr.type == CharAttr::DoubleRight) x--;
+	u16 x = mCursor.x;
+	if (mCursor.attr.type == CharAttr::DoubleRight) x--;
 
-		CharAttr attr = mCursor.attr;
-		if (mCursor.showed) {
-			u8 temp = attr.fcolor;
-			attr.fcolor = attr.bcolor;
-			attr.bcolor = temp;
-		}
+	CharAttr attr = mCursor.attr;
+	u8 temp = attr.fcolor;
+	attr.fcolor = attr.bcolor;
+	attr.bcolor = temp;
+	adjustCharAttr(attr);
 
-		drawChars(attr, x, mCursor.y, dw ? FW(2) : FW(1), 1, &mCursor.code, &dw);
-		break;
-	}
-	}
+	screen->overlayText(CursorOverlay, FW(x), FH(mCursor.y), attr.fcolor, attr.bcolor, mCursor.code, dw);
 }
 
 void FbShell::enableCursor(bool enable)
@@ -528,6 +684,10 @@ void FbShell::request(RequestType type,  u32 val)
 
 		if (active) {
 			screen->setPalette(mPalette);
+			invalidateGlass(0, 0, w(), h());
+			invalidateHistory();
+		} else {
+			manager->shellChanged();
 		}
 		break;
 
@@ -537,6 +697,10 @@ void FbShell::request(RequestType type,  u32 val)
 
 		if (active) {
 			screen->setPalette(defaultPalette);
+			invalidateGlass(0, 0, w(), h());
+			invalidateHistory();
+		} else {
+			manager->shellChanged();
 		}
 		break;
 
@@ -651,16 +815,15 @@ void FbShell::keyInput(s8 *buf, u32 len)
 void FbShell::mouseInput(u16 x, u16 y, s32 type, s32 buttons)
 {
 	if (type == Move) {
-		clearMousePointer();
-
 		CharAttr attr = charAttr(x, y);
 		adjustCharAttr(attr);
 
 		bool dw = (attr.type != CharAttr::Single);
 		u16 code = charCode(x, y);
 
+		// moving the pointer overlay puts back the pixels under its last position
 		if (attr.type == CharAttr::DoubleRight) x--;
-		screen->drawText(FW(x), FH(y), attr.bcolor, attr.fcolor, 1, &code, &dw);
+		screen->overlayText(PointerOverlay, FW(x), FH(y), attr.bcolor, attr.fcolor, code, dw);
 
 		mMousePointer.x = x;
 		mMousePointer.y = y;
@@ -680,12 +843,13 @@ void FbShell::clearMousePointer()
 {
 	if (mMousePointer.drawed) {
 		mMousePointer.drawed = false;
-		expose(mMousePointer.x, mMousePointer.y, 1, 1);
+		screen->hideOverlay(PointerOverlay);
 	}
 }
 
 void FbShell::expose(u16 x, u16 y, u16 w, u16 h)
 {
+	invalidateGlass(x, y, w, h);
 	VTerm::expose(x, y, w, h);
 
 	if (mode(CursorVisible) && mCursor.y >= y && mCursor.y < (y + h) && mCursor.x >= x && mCursor.x < (x + w)) {
@@ -771,3 +935,11 @@ bool FbShell::childProcessExited(s32 pid)
 
 	return false;
 }
+
+void FbShell::showStats(bool verbose)
+{
+	if (!verbose || !(mCellsDrawn + mCellsSkipped)) return;
+
+	printf("[term] cells drawn: %u, skipped as unchanged: %u (%u%%)\n",
+		mCellsDrawn, mCellsSkipped, (u32)(mCellsSkipped * 100ULL / (mCellsDrawn + mCellsSkipped)));
+}
@@ -34,6 +34,9 @@ public:
 	void imInput(s8 *buf, u32 len);
 	void ImExited() { mImProxy = 0; }
 	bool childProcessExited(s32 pid);
+	static void showStats(bool verbose);
+	// maps the attributes to the colors they are drawn with
+	static void adjustCharAttr(CharAttr &attr);
 
 private:
 	friend class FbShellManager;
@@ -41,19 +44,25 @@ private:
 	~FbShell();
 
 	virtual void drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws);
+	virtual void drawLine(u16 x, u16 y, u16 num, u16 *chars, bool *dws, CharAttr *attrs);
 	virtual bool moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h);
 	virtual void drawCursor(CharAttr attr, u16 x, u16 y, u16 c);
 	virtual void modeChanged(ModeType type);
 	virtual void request(RequestType type, u32 val = 0);
+	virtual bool deferUpdate();
 
 	virtual void initShellProcess();
 	virtual void readyRead(s8 *buf, u32 len);
 
 	void switchVt(bool enter, FbShell *peer);
-	void adjustCharAttr(CharAttr &attr);
 	void enableCursor(bool enable);
 	void updateCursor();
 	void clearMousePointer();
+	void drawSpan(u16 x, u16 y, u16 num, u16 *chars, bool *dws, u8 *fcs, u8 *bcs);
+	void redrawImWin();
+	bool updateGlass(CharAttr attr, u16 x, u16 y, u16 code, bool dw);
+	void invalidateGlass(u16 x, u16 y, u16 w, u16 h);
+	void moveGlass(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h, bool moved);
 
 	void changeMode(ModeType type, u16 val);
 	void reportCursor();
@@ -78,6 +87,13 @@ private:
 		bool drawed;
 	} mMousePointer;
 
+	// what has been drawn on the screen for every cell, drawLine skips the cells which are unchanged
+	struct GlassCell {
+		u16 code;
+		CharAttr attr;
+	} *mGlass;
+	static u32 mCellsDrawn, mCellsSkipped;
+
 	bool mPaletteChanged;
 	struct Color *mPalette;
 	class ImProxy *mImProxy;
@@ -22,6 +22,7 @@
 #include "fbshellman.h"
 #include "fbshell.h"
 #include "fbterm.h"
+#include "fbconfig.h"
 #include "screen.h"
 #include "improxy.h"
 #include "font.h"
@@ -34,10 +35,17 @@ DEFINE_INSTANCE_DEFAULT(FbShellManager)
 FbShellManager::FbShellManager()
 {
 	mVcCurrent = false;
+	mScreenStale = true;
 	mShellCount = 0;
 	mCurShell = 0;
 	mActiveShell = 0;
 	memset(mShellList, 0, sizeof(mShellList));
+
+	u32 fps = 60;
+	Config::instance()->getOption("max-fps", fps);
+	mFrameInterval = fps ? 1000000 / fps : 0;
+	mFramePending = false;
+	timerclear(&mLastFrame);
 }
 
 FbShellManager::~FbShellManager()
@@ -98,7 +106,9 @@ void FbShellManager::switchVc(bool enter)
 	mVcCurrent = enter;
 	setActive(enter ? mShellList[mCurShell] : 0);
 
-	if (enter) {
+	if (!enter) {
+		mScreenStale = false;
+	} else if (mScreenStale || !screen->restoreFromShadow()) {
 		redraw(0, 0, screen->cols(), screen->rows());
 	}
 }
@@ -109,9 +119,12 @@ void FbShellManager::shellExited(FbShell *shell)
 
 	u8 index = getIndex(shell, true, false);
 	mShellList[index] = 0;
+	mScreenStale = true;
 
 	if (index == mCurShell) {
-		prevShell();
+		// the output of the last shell is left on screen until fbterm exits
+		if (mShellCount == 1) setActive(0);
+		else prevShell();
 	}
 
 	if (!--mShellCount) {
@@ -144,6 +157,8 @@ bool FbShellManager::setActive(FbShell *shell)
 	if (mActiveShell == shell) return false;
 
 	if (mActiveShell) {
+		mFramePending = false;
+		mActiveShell->refresh();
 		mActiveShell->switchVt(false, shell);
 	}
 
@@ -172,3 +187,49 @@ void FbShellManager::childProcessExited(s32 pid)
 		if (mShellList[i] && mShellList[i]->childProcessExited(pid)) break;
 	}
 }
+
+static u32 usecsSince(const struct timeval &tv)
+{
+	struct timeval now;
+	gettimeofday(&now, 0);
+
+	s64 usecs = (s64)(now.tv_sec - tv.tv_sec) * 1000000 + (now.tv_usec - tv.tv_usec);
+	if (usecs < 0 || usecs > 0xffffffffLL) return 0xffffffff;
+	return usecs;
+}
+
+bool FbShellManager::deferFrame()
+{
+	if (!mFrameInterval) return false;
+
+	if (usecsSince(mLastFrame) >= mFrameInterval) {
+		mFramePending = false;
+		gettimeofday(&mLastFrame, 0);
+		return false;
+	}
+
+	mFramePending = true;
+	return true;
+}
+
+s32 FbShellManager::frameTimeout()
+{
+	if (!mFramePending) return -1;
+
+	u32 elapsed = usecsSince(mLastFrame);
+	if (elapsed >= mFrameInterval) return 0;
+	return (mFrameInterval - elapsed + 999) / 1000;
+}
+
+void FbShellManager::drawFrame()
+{
+	if (mFramePending && usecsSince(mLastFrame) >= mFrameInterval) {
+		mFramePending = false;
+		gettimeofday(&mLastFrame, 0);
+
+		if (mActiveShell) mActiveShell->refresh();
+	}
+
+	// input method windows are repainted once for all the text drawn over their edges
+	if (mActiveShell) mActiveShell->redrawImWin();
+}
@@ -21,6 +21,7 @@
 #ifndef FBSHELL_MANAGER_H
 #define FBSHELL_MANAGER_H
 
+#include <sys/time.h>
 #include "type.h"
 #include "instance.h"
 
@@ -44,6 +45,13 @@ public:
 	void redraw(u16 x, u16 y, u16 w, u16 h);
 	void switchVc(bool enter);
 	void childProcessExited(s32 pid);
+	void shellChanged() {
+		mScreenStale = true;
+	}
+
+	bool deferFrame();
+	s32 frameTimeout();
+	void drawFrame();
 
 private:
 	u32 getIndex(FbShell *shell, bool forward, bool stepfirst);
@@ -53,6 +61,12 @@ private:
 	FbShell *mShellList[NR_SHELLS], *mActiveShell;
 	u32 mShellCount, mCurShell;
 	bool mVcCurrent;
+	bool mScreenStale;
+
+	// output of the active shell is drawn at most once per mFrameInterval microseconds
+	u32 mFrameInterval;
+	struct timeval mLastFrame;
+	bool mFramePending;
 };
 
 #endif
@@ -32,10 +32,12 @@
 #include "fbshellman.h"
 #include "fbconfig.h"
 #include "fbio.h"
+#include "font.h"
 #include "screen.h"
 #include "input.h"
 #include "input_key.h"
 #include "mouse.h"
+#include "rendercheck.h"
 
 #ifdef HAVE_SIGNALFD
 // <sys/signalfd.h> offered by some systems has bug with g++
@@ -106,6 +108,14 @@ FbTerm::~FbTerm()
 	IoDispatcher::uninstance();
 	FbShellManager::uninstance();
 	Screen::uninstance();
+
+	bool verbose = false;
+	Config::instance()->getOption("verbose", verbose);
+	if (mInit) {
+		Screen::showStats(verbose);
+		Font::showStats(verbose);
+		FbShell::showStats(verbose);
+	}
 }
 
 void FbTerm::init()
@@ -151,6 +161,11 @@ void FbTerm::init()
 
 static bool isActiveTerm()
 {
+	// a memory screen has no console of its own to be switched away from
+	s8 mem[32];
+	Config::instance()->getOption("mem-screen", mem, sizeof(mem));
+	if (*mem) return true;
+
 	struct vt_stat vtstat;
 	ioctl(STDIN_FILENO, VT_GETSTATE, &vtstat);
 
@@ -170,11 +185,16 @@ void FbTerm::run()
 
 	mRun = true;
 	FbIoDispatcher *io = (FbIoDispatcher*)IoDispatcher::instance();
+	FbShellManager *manager = FbShellManager::instance();
+	Screen *screen = Screen::instance();
 	while (mRun) {
-		io->poll();
+		// wait no longer than until a deferred frame is due
+		io->poll(manager->frameTimeout());
 #ifndef HAVE_SIGNALFD
 		pollSignal();
 #endif
+		manager->drawFrame();
+		screen->flush();
 	}
 
 	if (isActiveTerm()) processSignal(SIGUSR1);
@@ -292,11 +312,19 @@ int main(int argc, char **argv)
 {
 	seteuid(getuid());
 
+	s32 ret = 0;
 	if (Config::instance()->parseArgs(argc, argv)) {
-		FbTerm::instance()->run();
-		FbTerm::uninstance();
+		bool check = false;
+		Config::instance()->getOption("render-check", check);
+
+		if (check) {
+			ret = RenderCheck::run();
+		} else {
+			FbTerm::instance()->run();
+			FbTerm::uninstance();
+		}
 	}
 
 	Config::uninstance();
-	return 0;
+	return ret;
 }
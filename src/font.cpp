@@ -18,12 +18,21 @@
  *
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <fontconfig/fontconfig.h>
 #include <ft2build.h>
 #include FT_GLYPH_H
 #include "font.h"
 #include "screen.h"
 #include "fbconfig.h"
+#include "vterm.h"
 
 #define OFFSET(TYPE, MEMBER) ((size_t)(&(((TYPE *)0)->MEMBER)))
 #define SUBS(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
@@ -36,10 +45,62 @@ static FT_Library ftlib;
 static FT_Face *fontFaces;
 static u32 *fontFlags;
 
-static Font::Glyph **glyphCache;
-static bool *glyphCacheInited;
+// glyphs are kept in a two level table covering all of unicode, its pages of 256 are made when
+// first needed. beyond glyph-cache-size KB, the glyphs least recently used are dropped, but never
+// those used since the last frame, the render threads may still be drawing them
+#define NR_UNICODE 0x110000
+
+struct CachedGlyph {
+	// most recently used first
+	CachedGlyph *prev, *next;
+	u32 unicode, frame, size;
+	Font::Glyph glyph;
+};
+
+static CachedGlyph **glyphPages[NR_UNICODE >> 8];
+static CachedGlyph *lruHead, *lruTail;
+static u32 glyphFrame;
+static u32 cacheLimit, cacheCount, cacheBytes, evictCount;
+
+// glyphs drawn before are kept in a file under $XDG_CACHE_HOME/fbterm and mapped read-only, so that
+// they cost no rendering and no memory of our own. the file is named after the font names, size and
+// rotation, the key in it covers everything else the glyphs depend on, the font files included.
+// glyphs rendered besides it are added to a new file when the font is done with
+#define GLYPH_FILE_VERSION 1
+
+struct GlyphFileHeader {
+	s8 magic[8];
+	u32 version, size, glyphs;
+	u64 key;
+	// offsets of the tables of 256 glyph offsets, 0 for pages without glyphs
+	u32 pages[NR_UNICODE >> 8];
+};
+
+struct FileGlyph {
+	// of the pixmap
+	u32 size;
+	Font::Glyph glyph;
+};
+
+static bool glyphFile, glyphFileOpened;
+static s8 glyphFilePath[PATH_MAX];
+static u8 *fileMap;
+static u32 fileSize;
+static u64 fileKey;
+static u32 fileGlyphs, fileAdded;
+
+// glyph bitmaps are padded to whole cells
+static bool padGlyphs;
+static u32 glyphCount, glyphBytes, padBytes;
+// box drawing, block element and braille characters don't come from the fonts
+static bool boxGlyphs = true;
+static u32 boxCount;
 
 static void openFont(u32 index);
+static int loadFlags(FcPattern *pattern);
+static void openGlyphFile(u32 width, u32 height);
+static void saveGlyphFile();
+static void closeGlyphFile();
 
 DEFINE_INSTANCE(Font)
 
@@ -111,9 +172,19 @@ Font::Font()
 	fontFlags = new u32[fontList->nfont];
 	memset(fontFaces, 0, sizeof(FT_Face) * fontList->nfont);
 
-	glyphCache = new Glyph *[256 * 256];
-	glyphCacheInited = new bool[256];
-	memset(glyphCacheInited, 0, sizeof(bool) * 256);
+	u32 limit = 4096;
+	Config::instance()->getOption("glyph-cache-size", limit);
+	cacheLimit = limit * 1024;
+	lruHead = lruTail = 0;
+	cacheCount = cacheBytes = 0;
+
+	glyphFile = false;
+	Config::instance()->getOption("glyph-cache-file", glyphFile);
+	glyphFileOpened = false;
+	fileGlyphs = fileAdded = 0;
+
+	Config::instance()->getOption("pad-glyphs", padGlyphs);
+	Config::instance()->getOption("draw-box-glyphs", boxGlyphs);
 
 	FT_Init_FreeType(&ftlib);
 	openFont(0);
@@ -169,18 +240,21 @@ Font::Font()
 
 Font::~Font()
 {
-	for (u32 i = 0; i < 256; i++) {
-		if (!glyphCacheInited[i]) continue;
+	saveGlyphFile();
+	closeGlyphFile();
+
+	for (u32 i = 0; i < (NR_UNICODE >> 8); i++) {
+		if (!glyphPages[i]) continue;
 
 		for (u32 j = 0; j < 256; j++) {
-			if (glyphCache[i * 256 + j]) {
-				delete[] (u8 *)glyphCache[i * 256 + j];
+			if (glyphPages[i][j]) {
+				delete[] (u8 *)glyphPages[i][j];
 			}
 		}
-	}
 
-	delete[] glyphCache;
-	delete[] glyphCacheInited;
+		delete[] glyphPages[i];
+		glyphPages[i] = 0;
+	}
 
 	for (u32 i = 0; i < fontList->nfont; i++) {
 		if (fontFaces[i] && fontFaces[i] != (FT_Face)-1) {
@@ -212,6 +286,23 @@ void Font::showInfo(bool verbose)
 
 	FcPatternGetString(fontList->fonts[index], FC_FAMILY, 0, &family);
 	printf("%s\n", family);
+
+	printf("[font] glyph cache: %u glyphs in %uKB", cacheCount, cacheBytes >> 10);
+	if (cacheLimit) printf(" of %uKB", cacheLimit >> 10);
+	printf("\n");
+}
+
+void Font::showStats(bool verbose)
+{
+	if (!verbose || (!glyphCount && !fileGlyphs)) return;
+
+	printf("[font] glyphs: %u, bitmaps: %uKB", glyphCount, glyphBytes >> 10);
+	if (padGlyphs) printf(", %uKB of it cell padding", padBytes >> 10);
+	if (boxCount) printf(", %u box glyphs drawn", boxCount);
+	printf(", cache: %u glyphs in %uKB", cacheCount, cacheBytes >> 10);
+	if (evictCount) printf(", %u dropped", evictCount);
+	if (fileGlyphs || fileAdded) printf(", file: %u glyphs, %u added", fileGlyphs, fileAdded);
+	printf("\n");
 }
 
 static void openFont(u32 index)
@@ -236,17 +327,24 @@ static void openFont(u32 index)
 	FcPatternGetDouble(pattern, FC_PIXEL_SIZE, 0, &ysize);
 	FT_Set_Pixel_Sizes(face, 0, (FT_UInt)ysize);
 
+	fontFaces[index] = face;
+	fontFlags[index] = loadFlags(pattern);
+}
+
+static int loadFlags(FcPattern *pattern)
+{
 	int load_flags = FT_LOAD_DEFAULT;
 
-	FcBool scalable, antialias;
+	// fontconfig may leave any of these out, antialiased and hinted glyphs are freetype's own default
+	FcBool scalable = FcFalse, antialias = FcTrue;
 	FcPatternGetBool(pattern, FC_SCALABLE, 0, &scalable);
 	FcPatternGetBool(pattern, FC_ANTIALIAS, 0, &antialias);
 
 	if (scalable && antialias) load_flags |= FT_LOAD_NO_BITMAP;
 
 	if (antialias) {
-		FcBool hinting;
-		int hint_style;
+		FcBool hinting = FcTrue;
+		int hint_style = FC_HINT_SLIGHT;
 		FcPatternGetBool(pattern, FC_HINTING, 0, &hinting);
 		FcPatternGetInteger(pattern, FC_HINT_STYLE, 0, &hint_style);
 
@@ -259,8 +357,7 @@ static void openFont(u32 index)
 		load_flags |= FT_LOAD_TARGET_MONO;
 	}
 
-	fontFaces[index] = face;
-	fontFlags[index] = load_flags;
+	return load_flags;
 }
 
 static int fontIndex(u32 unicode)
@@ -276,16 +373,115 @@ static int fontIndex(u32 unicode)
 	return -1;
 }
 
-Font::Glyph *Font::getGlyph(u32 unicode)
+static Font::Glyph *newGlyph(u32 pixmapSize)
+{
+	u32 size = OFFSET(CachedGlyph, glyph) + OFFSET(Font::Glyph, pixmap) + pixmapSize;
+	CachedGlyph *cached = (CachedGlyph *)new u8[size];
+	cached->size = size;
+	return &cached->glyph;
+}
+
+static void unlinkGlyph(CachedGlyph *cached)
+{
+	if (cached->prev) cached->prev->next = cached->next;
+	else lruHead = cached->next;
+
+	if (cached->next) cached->next->prev = cached->prev;
+	else lruTail = cached->prev;
+}
+
+static void pushGlyph(CachedGlyph *cached)
+{
+	cached->frame = glyphFrame;
+	cached->prev = 0;
+	cached->next = lruHead;
+
+	if (lruHead) lruHead->prev = cached;
+	else lruTail = cached;
+	lruHead = cached;
+}
+
+static void evictGlyphs(u32 size)
+{
+	while (cacheLimit && cacheBytes + size > cacheLimit && lruTail && lruTail->frame != glyphFrame) {
+		CachedGlyph *cached = lruTail;
+		unlinkGlyph(cached);
+		glyphPages[cached->unicode >> 8][cached->unicode & 0xff] = 0;
+
+		cacheCount--;
+		cacheBytes -= cached->size;
+		evictCount++;
+		delete[] (u8 *)cached;
+	}
+}
+
+static Font::Glyph *cacheGlyph(u32 unicode, Font::Glyph *glyph)
+{
+	CachedGlyph *cached = (CachedGlyph *)((u8 *)glyph - OFFSET(CachedGlyph, glyph));
+	evictGlyphs(cached->size);
+
+	CachedGlyph **page = glyphPages[unicode >> 8];
+	if (!page) {
+		page = glyphPages[unicode >> 8] = new CachedGlyph *[256];
+		memset(page, 0, sizeof(CachedGlyph *) * 256);
+	}
+
+	cached->unicode = unicode;
+	pushGlyph(cached);
+	page[unicode & 0xff] = cached;
+
+	cacheCount++;
+	cacheBytes += cached->size;
+	return glyph;
+}
+
+void Font::endFrame()
+{
+	glyphFrame++;
+}
+
+static Font::Glyph *fileGlyph(u32 unicode)
+{
+	if (!fileMap) return 0;
+
+	u32 page = ((GlyphFileHeader *)fileMap)->pages[unicode >> 8];
+	if (!page) return 0;
+
+	u32 offset = ((u32 *)(fileMap + page))[unicode & 0xff];
+	return offset ? &((FileGlyph *)(fileMap + offset))->glyph : 0;
+}
+
+Font::Glyph *Font::loadedGlyph(u32 unicode)
 {
-	if (unicode >= 256 * 256) return 0;
+	if (unicode >= NR_UNICODE) return 0;
 
-	if (!glyphCacheInited[unicode >> 8]) {
-		glyphCacheInited[unicode >> 8] = true;
-		memset(&glyphCache[unicode & 0xff00], 0, sizeof(Glyph *) * 256);
+	CachedGlyph **page = glyphPages[unicode >> 8];
+	CachedGlyph *cached = page ? page[unicode & 0xff] : 0;
+	return cached ? &cached->glyph : fileGlyph(unicode);
+}
+
+Font::Glyph *Font::getGlyph(u32 unicode)
+{
+	if (unicode >= NR_UNICODE) return 0;
+
+	CachedGlyph **page = glyphPages[unicode >> 8];
+	CachedGlyph *cached = page ? page[unicode & 0xff] : 0;
+	if (cached) {
+		// moved to the front once a frame, which is all the order eviction needs
+		if (cached->frame != glyphFrame) {
+			unlinkGlyph(cached);
+			pushGlyph(cached);
+		}
+		return &cached->glyph;
 	}
 
-	if (glyphCache[unicode]) return glyphCache[unicode];
+	if (boxGlyphs && isBoxChar(unicode)) return cacheGlyph(unicode, boxGlyph(unicode));
+
+	// the glyphs are drawn rotated, which is only known once the screen is there
+	if (glyphFile && !glyphFileOpened) openGlyphFile(mWidth, mHeight);
+
+	Glyph *saved = fileGlyph(unicode);
+	if (saved) return saved;
 
 	int i = fontIndex(unicode);
 	if (i == -1) return 0;
@@ -300,30 +496,320 @@ Font::Glyph *Font::getGlyph(u32 unicode)
 	FT_Load_Glyph(face, index, FT_LOAD_RENDER | fontFlags[i]);
 	FT_Bitmap &bitmap = face->glyph->bitmap;
 
+	s32 left = face->glyph->metrics.horiBearingX >> 6;
+	s32 top = mHeight - 1 + (face->size->metrics.descender >> 6) - (face->glyph->metrics.horiBearingY >> 6);
+	s32 width = face->glyph->metrics.width >> 6;
+	s32 height = face->glyph->metrics.height >> 6;
+
 	u32 x, y, w, h, nx, ny, nw, nh;
 	x = y = 0;
 	w = nw = bitmap.width;
 	h = nh = bitmap.rows;
+
+	// a padded glyph is clipped to its cell and placed in it here, once, so that drawing it is a
+	// plain copy of the cell, glyphs reaching into the cell on their left can't be padded
+	bool pad = padGlyphs && left >= 0;
+	u32 cw = w, ch = h;
+
+	if (pad) {
+		if (top < 0) top = 0;
+		cw = (left + MIN((s32)w, width) <= (s32)mWidth) ? mWidth : mWidth * 2;
+		ch = mHeight;
+
+		w = (left >= (s32)cw) ? 0 : MIN((s32)w, MIN(width, (s32)cw - left));
+		h = (top >= (s32)ch) ? 0 : MIN((s32)h, MIN(height, (s32)ch - top));
+		nw = cw, nh = ch;
+	}
+
 	Screen::instance()->rotateRect(x, y, nw, nh);
 
-	Glyph *glyph = (Glyph *)new u8[OFFSET(Glyph, pixmap) + nw * nh];
-	glyph->left = face->glyph->metrics.horiBearingX >> 6;
-	glyph->top = mHeight - 1 + (face->size->metrics.descender >> 6) - (face->glyph->metrics.horiBearingY >> 6);
-	glyph->width = face->glyph->metrics.width >> 6;
-	glyph->height = face->glyph->metrics.height >> 6;
+	Glyph *glyph = newGlyph(nw * nh);
+	glyph->left = pad ? 0 : left;
+	glyph->top = pad ? 0 : top;
+	glyph->width = pad ? cw : width;
+	glyph->height = pad ? ch : height;
 	glyph->pitch = nw;
 
+	if (pad) {
+		memset(glyph->pixmap, 0, nw * nh);
+		padBytes += nw * nh - bitmap.width * bitmap.rows;
+	}
+
+	glyphCount++;
+	glyphBytes += OFFSET(Glyph, pixmap) + nw * nh;
+
 	u8 *buf = bitmap.buffer;
 	for (y = 0; y < h; y++, buf += bitmap.pitch) {
 		for (x = 0; x < w; x++) {
 			nx = x, ny = y;
-			Screen::instance()->rotatePoint(w, h, nx, ny);
+			if (pad) nx += left, ny += top;
+			Screen::instance()->rotatePoint(cw, ch, nx, ny);
 
 			glyph->pixmap[ny * nw + nx] =
 				(bitmap.pixel_mode == FT_PIXEL_MODE_MONO) ? ((buf[(x >> 3)] & (0x80 >> (x & 7))) ? 0xff : 0) : buf[x];
 		}
 	}
 
-	glyphCache[unicode] = glyph;
+	if (glyphFileOpened) fileAdded++;
+	return cacheGlyph(unicode, glyph);
+}
+
+Font::Glyph *Font::boxGlyph(u32 unicode)
+{
+	// drawn at the size of the cells, so that lines and blocks meet those of the next cells,
+	// ambiguous width characters are two cells wide when they are treated as wide
+	u32 cw = mWidth * (VTerm::charWidth(unicode) == 2 ? 2 : 1), ch = mHeight;
+	u8 *cell = new u8[cw * ch];
+	drawBoxChar(unicode, cell, cw, ch);
+
+	u32 x = 0, y = 0, nw = cw, nh = ch, nx, ny;
+	Screen::instance()->rotateRect(x, y, nw, nh);
+
+	Glyph *glyph = newGlyph(nw * nh);
+	glyph->left = glyph->top = 0;
+	glyph->width = cw;
+	glyph->height = ch;
+	glyph->pitch = nw;
+
+	for (y = 0; y < ch; y++) {
+		for (x = 0; x < cw; x++) {
+			nx = x, ny = y;
+			Screen::instance()->rotatePoint(cw, ch, nx, ny);
+			glyph->pixmap[ny * nw + nx] = cell[y * cw + x];
+		}
+	}
+
+	delete[] cell;
+
+	glyphCount++;
+	boxCount++;
+	glyphBytes += OFFSET(Glyph, pixmap) + nw * nh;
+	return glyph;
+}
+
+static u64 hashBytes(u64 hash, const void *data, u32 len)
+{
+	// FNV-1a
+	const u8 *bytes = (const u8 *)data;
+	while (len--) {
+		hash = (hash ^ *bytes++) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static bool checkGlyphFile(const u8 *map, u32 size, RotateType rotate)
+{
+	const GlyphFileHeader *header = (const GlyphFileHeader *)map;
+	if (memcmp(header->magic, "FBTGLYPH", 8) || header->version != GLYPH_FILE_VERSION
+		|| header->size != size || header->key != fileKey) return false;
+
+	// the offsets are followed later without checks
+	for (u32 i = 0; i < (NR_UNICODE >> 8); i++) {
+		u32 page = header->pages[i];
+		if (!page) continue;
+		if ((page & 3) || page < sizeof(GlyphFileHeader) || page > size - 256 * sizeof(u32)) return false;
+
+		const u32 *offsets = (const u32 *)(map + page);
+		for (u32 j = 0; j < 256; j++) {
+			u32 offset = offsets[j];
+			if (!offset) continue;
+			if ((offset & 3) || offset < sizeof(GlyphFileHeader) || offset > size - OFFSET(FileGlyph, glyph.pixmap)) return false;
+
+			const FileGlyph *glyph = (const FileGlyph *)(map + offset);
+			if (glyph->size > size - offset - OFFSET(FileGlyph, glyph.pixmap)) return false;
+
+			// drawGlyph() reads as much of the pixmap as the header tells, a line of the pixmap runs
+			// along the width of the glyph, or along its height when the glyphs are rotated by 90/270
+			const Font::Glyph &g = glyph->glyph;
+			bool swap = (rotate == Rotate90 || rotate == Rotate270);
+			s32 across = swap ? g.height : g.width, lines = swap ? g.width : g.height;
+			if (g.pitch < 0 || g.width < 0 || g.height < 0 || across > g.pitch
+				|| (u32)g.pitch * lines > glyph->size) return false;
+		}
+	}
+
+	return true;
+}
+
+static void openGlyphFile(u32 width, u32 height)
+{
+	glyphFileOpened = true;
+	glyphFilePath[0] = 0;
+
+	s8 dir[PATH_MAX];
+	const s8 *cache = getenv("XDG_CACHE_HOME");
+	if (cache && *cache == '/') {
+		snprintf(dir, sizeof(dir), "%s", cache);
+	} else {
+		const s8 *home = getenv("HOME");
+		if (!home) return;
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+	}
+
+	mkdir(dir, 0700);
+	strncat(dir, "/fbterm", sizeof(dir) - strlen(dir) - 1);
+	mkdir(dir, 0700);
+
+	// the name tells the fonts asked for, their size and the way the glyphs are laid out
+	s8 names[64];
+	Config::instance()->getOption("font-names", names, sizeof(names));
+
+	double size = 0;
+	FcPatternGetDouble(fontList->fonts[0], FC_PIXEL_SIZE, 0, &size);
+
+	u32 layout[] = { width, height, padGlyphs, boxGlyphs, Screen::instance()->renderRotate(), GLYPH_FILE_VERSION };
+
+	u64 name = 0xcbf29ce484222325ULL;
+	name = hashBytes(name, names, strlen(names));
+	name = hashBytes(name, &size, sizeof(size));
+	name = hashBytes(name, layout, sizeof(layout));
+
+	// the key adds the fonts themselves and the library rendering them
+	FT_Int version[3];
+	FT_Library_Version(ftlib, &version[0], &version[1], &version[2]);
+
+	fileKey = hashBytes(name, version, sizeof(version));
+
+	for (s32 i = 0; i < fontList->nfont; i++) {
+		FcPattern *pattern = fontList->fonts[i];
+
+		FcChar8 *file = (FcChar8 *)"";
+		FcPatternGetString(pattern, FC_FILE, 0, &file);
+
+		struct stat fontStat;
+		if (stat((const char *)file, &fontStat) == -1) memset(&fontStat, 0, sizeof(fontStat));
+
+		int index = 0;
+		FcPatternGetInteger(pattern, FC_INDEX, 0, &index);
+
+		double fontSize = 0;
+		FcPatternGetDouble(pattern, FC_PIXEL_SIZE, 0, &fontSize);
+
+		s64 font[] = { index, loadFlags(pattern), fontStat.st_mtime, fontStat.st_size, (s64)(fontSize * 64) };
+
+		fileKey = hashBytes(fileKey, file, strlen((const char *)file) + 1);
+		fileKey = hashBytes(fileKey, font, sizeof(font));
+	}
+
+	snprintf(glyphFilePath, sizeof(glyphFilePath), "%s/glyphs-%016llx", dir, name);
+
+	s32 fd = open(glyphFilePath, O_RDONLY);
+	if (fd == -1) return;
+
+	struct stat cstat;
+	if (fstat(fd, &cstat) == -1 || cstat.st_size < (off_t)sizeof(GlyphFileHeader) || cstat.st_size > 0x7fffffff) {
+		close(fd);
+		return;
+	}
+
+	u8 *map = (u8 *)mmap(0, cstat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return;
+
+	if (!checkGlyphFile(map, cstat.st_size, Screen::instance()->renderRotate())) {
+		munmap(map, cstat.st_size);
+		return;
+	}
+
+	fileMap = map;
+	fileSize = cstat.st_size;
+	fileGlyphs = ((GlyphFileHeader *)map)->glyphs;
+}
+
+static void closeGlyphFile()
+{
+	if (fileMap) munmap(fileMap, fileSize);
+	fileMap = 0;
+	fileSize = 0;
+}
+
+// the glyph a new file keeps for unicode, the one rendered this time or the one in the old file
+static Font::Glyph *savedGlyph(u32 unicode, u32 &size)
+{
+	CachedGlyph **page = glyphPages[unicode >> 8];
+	CachedGlyph *cached = page ? page[unicode & 0xff] : 0;
+	if (cached) {
+		size = cached->size - OFFSET(CachedGlyph, glyph.pixmap);
+		return &cached->glyph;
+	}
+
+	Font::Glyph *glyph = fileGlyph(unicode);
+	if (glyph) size = ((FileGlyph *)((u8 *)glyph - OFFSET(FileGlyph, glyph)))->size;
 	return glyph;
 }
+
+#define ALIGN4(n) (((n) + 3) & ~3)
+
+static void saveGlyphFile()
+{
+	if (!fileAdded || !glyphFilePath[0]) return;
+
+	u32 size = sizeof(GlyphFileHeader), glyphs = 0, pixmap;
+	for (u32 unicode = 0; unicode < NR_UNICODE; unicode++) {
+		if (!(unicode & 0xff)) {
+			bool empty = true;
+			for (u32 j = 0; j < 256 && empty; j++) {
+				if (savedGlyph(unicode + j, pixmap)) empty = false;
+			}
+
+			if (empty) {
+				unicode += 0xff;
+				continue;
+			}
+			size += 256 * sizeof(u32);
+		}
+
+		if (!savedGlyph(unicode, pixmap)) continue;
+		size += ALIGN4(OFFSET(FileGlyph, glyph.pixmap) + pixmap);
+		glyphs++;
+	}
+
+	u8 *buf = new u8[size];
+	memset(buf, 0, size);
+
+	GlyphFileHeader *header = (GlyphFileHeader *)buf;
+	memcpy(header->magic, "FBTGLYPH", 8);
+	header->version = GLYPH_FILE_VERSION;
+	header->size = size;
+	header->glyphs = glyphs;
+	header->key = fileKey;
+
+	u32 offset = sizeof(GlyphFileHeader);
+	u32 *offsets = 0;
+	for (u32 unicode = 0; unicode < NR_UNICODE; unicode++) {
+		Font::Glyph *glyph = savedGlyph(unicode, pixmap);
+		if (!glyph) continue;
+
+		if (!header->pages[unicode >> 8]) {
+			header->pages[unicode >> 8] = offset;
+			offsets = (u32 *)(buf + offset);
+			offset += 256 * sizeof(u32);
+		}
+
+		offsets[unicode & 0xff] = offset;
+
+		FileGlyph *saved = (FileGlyph *)(buf + offset);
+		saved->size = pixmap;
+		memcpy(&saved->glyph, glyph, OFFSET(Font::Glyph, pixmap) + pixmap);
+		offset += ALIGN4(OFFSET(FileGlyph, glyph.pixmap) + pixmap);
+	}
+
+	// written aside and renamed over the old file, which others may still have mapped
+	s8 temp[PATH_MAX + 16];
+	snprintf(temp, sizeof(temp), "%s.%d", glyphFilePath, getpid());
+
+	s32 fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd != -1) {
+		u32 written = 0;
+		while (written < size) {
+			s32 ret = write(fd, buf + written, size - written);
+			if (ret <= 0) break;
+			written += ret;
+		}
+		close(fd);
+
+		if (written < size || rename(temp, glyphFilePath) == -1) unlink(temp);
+	}
+
+	delete[] buf;
+}
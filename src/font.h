@@ -37,6 +37,10 @@ public:
 	};
 
 	Glyph *getGlyph(u32 unicode);
+	// never loads a glyph, so it is safe to call from the render threads
+	Glyph *loadedGlyph(u32 unicode);
+	// glyphs got before are done with once the frame is flushed, the glyph cache may drop them
+	void endFrame();
 	u32 width() {
 		return mWidth;
 	}
@@ -44,8 +48,14 @@ public:
 		return mHeight;
 	}
 	void showInfo(bool verbose);
+	static void showStats(bool verbose);
 
 private:
+	// box drawing, block element and braille characters are drawn here to fill whole cells, see font_box.cpp
+	static bool isBoxChar(u32 unicode);
+	static void drawBoxChar(u32 unicode, u8 *pixmap, u32 w, u32 h);
+	Glyph *boxGlyph(u32 unicode);
+
 	u32 mWidth, mHeight;
 };
 
@@ -0,0 +1,282 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+#include "font.h"
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// the arms of a box drawing character going out from the cell center, two bits each
+typedef enum { None = 0, Light, Heavy, Double } ArmType;
+
+#define ARMS(up, right, down, left) (((up) << 6) | ((right) << 4) | ((down) << 2) | (left))
+#define U(t) ARMS(t, 0, 0, 0)
+#define R(t) ARMS(0, t, 0, 0)
+#define D(t) ARMS(0, 0, t, 0)
+#define L(t) ARMS(0, 0, 0, t)
+
+// U+2500 - U+257F, zero for the dashes, arcs and diagonals, which are drawn on their own
+static const u8 boxArms[128] = {
+	L(1) | R(1), L(2) | R(2), U(1) | D(1), U(2) | D(2), 0, 0, 0, 0,
+	0, 0, 0, 0, D(1) | R(1), D(1) | R(2), D(2) | R(1), D(2) | R(2),
+	D(1) | L(1), D(1) | L(2), D(2) | L(1), D(2) | L(2), U(1) | R(1), U(1) | R(2), U(2) | R(1), U(2) | R(2),
+	U(1) | L(1), U(1) | L(2), U(2) | L(1), U(2) | L(2), U(1) | D(1) | R(1), U(1) | D(1) | R(2), U(2) | D(1) | R(1), U(1) | D(2) | R(1),
+	U(2) | D(2) | R(1), U(2) | D(1) | R(2), U(1) | D(2) | R(2), U(2) | D(2) | R(2), U(1) | D(1) | L(1), U(1) | D(1) | L(2), U(2) | D(1) | L(1), U(1) | D(2) | L(1),
+	U(2) | D(2) | L(1), U(2) | D(1) | L(2), U(1) | D(2) | L(2), U(2) | D(2) | L(2), D(1) | L(1) | R(1), D(1) | L(2) | R(1), D(1) | L(1) | R(2), D(1) | L(2) | R(2),
+	D(2) | L(1) | R(1), D(2) | L(2) | R(1), D(2) | L(1) | R(2), D(2) | L(2) | R(2), U(1) | L(1) | R(1), U(1) | L(2) | R(1), U(1) | L(1) | R(2), U(1) | L(2) | R(2),
+	U(2) | L(1) | R(1), U(2) | L(2) | R(1), U(2) | L(1) | R(2), U(2) | L(2) | R(2), ARMS(1, 1, 1, 1), ARMS(1, 1, 1, 2), ARMS(1, 2, 1, 1), ARMS(1, 2, 1, 2),
+	ARMS(2, 1, 1, 1), ARMS(1, 1, 2, 1), ARMS(2, 1, 2, 1), ARMS(2, 1, 1, 2), ARMS(2, 2, 1, 1), ARMS(1, 1, 2, 2), ARMS(1, 2, 2, 1), ARMS(2, 2, 1, 2),
+	ARMS(1, 2, 2, 2), ARMS(2, 1, 2, 2), ARMS(2, 2, 2, 1), ARMS(2, 2, 2, 2), 0, 0, 0, 0,
+	L(3) | R(3), U(3) | D(3), D(1) | R(3), D(3) | R(1), D(3) | R(3), D(1) | L(3), D(3) | L(1), D(3) | L(3),
+	U(1) | R(3), U(3) | R(1), U(3) | R(3), U(1) | L(3), U(3) | L(1), U(3) | L(3), U(1) | D(1) | R(3), U(3) | D(3) | R(1),
+	U(3) | D(3) | R(3), U(1) | D(1) | L(3), U(3) | D(3) | L(1), U(3) | D(3) | L(3), D(1) | L(3) | R(3), D(3) | L(1) | R(1), D(3) | L(3) | R(3), U(1) | L(3) | R(3),
+	U(3) | L(1) | R(1), U(3) | L(3) | R(3), ARMS(1, 3, 1, 3), ARMS(3, 1, 3, 1), ARMS(3, 3, 3, 3), 0, 0, 0,
+	0, 0, 0, 0, L(1), U(1), R(1), D(1),
+	L(2), U(2), R(2), D(2), L(1) | R(2), U(1) | D(2), L(2) | R(1), U(2) | D(1),
+};
+
+// quadrants of U+2596 - U+259F: upper left, upper right, lower left, lower right
+static const u8 blockQuadrants[10] = {
+	4, 8, 1, 1 | 4 | 8, 1 | 8, 1 | 2 | 4, 1 | 2 | 8, 2, 2 | 4, 2 | 4 | 8,
+};
+
+static u8 *cell;
+static s32 cellW, cellH;
+
+static void fill(s32 x0, s32 y0, s32 x1, s32 y1, u8 value = 0xff)
+{
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > cellW) x1 = cellW;
+	if (y1 > cellH) y1 = cellH;
+
+	for (s32 y = y0; y < y1; y++) {
+		if (x1 > x0) memset(cell + y * cellW + x0, value, x1 - x0);
+	}
+}
+
+// the coverage of a stroke of thickness t along a line or circle, sampled 4 x 4 times per pixel,
+// dist() gives the distance of a point from the stroke center, or -1 when it is off the stroke
+static void stroke(double (*dist)(double x, double y, const double *args), const double *args, double t)
+{
+	for (s32 y = 0; y < cellH; y++) {
+		for (s32 x = 0; x < cellW; x++) {
+			u32 hits = 0;
+			for (u32 sy = 0; sy < 4; sy++) {
+				for (u32 sx = 0; sx < 4; sx++) {
+					double d = dist(x + (sx + 0.5) / 4, y + (sy + 0.5) / 4, args);
+					if (d >= 0 && d <= t / 2) hits++;
+				}
+			}
+
+			u8 &pixel = cell[y * cellW + x];
+			u32 value = hits * 0xff / 16;
+			if (value > pixel) pixel = value;
+		}
+	}
+}
+
+// args: a point of the line and its direction
+static double lineDist(double x, double y, const double *args)
+{
+	return fabs((x - args[0]) * args[3] - (y - args[1]) * args[2]) / sqrt(args[2] * args[2] + args[3] * args[3]);
+}
+
+// args: the circle center, its radius and which quadrant of it, as the signs of x and y
+static double arcDist(double x, double y, const double *args)
+{
+	double dx = x - args[0], dy = y - args[1];
+	if (dx * args[3] < 0 || dy * args[4] < 0) return -1;
+	return fabs(sqrt(dx * dx + dy * dy) - args[2]);
+}
+
+static void drawBox(u32 code)
+{
+	// every cell puts its lines at the same place, so that they join up with those of its neighbours
+	s32 light = MAX(1, cellW / 8), heavy = light * 3 / 2 + 1;
+	s32 cx = cellW / 2, cy = cellH / 2;
+
+	#define THICK(type) ((type) == Light ? light : (type) == Heavy ? heavy : (type) == Double ? light * 3 : 0)
+	#define SX(t) (cx - (t) / 2)
+	#define SY(t) (cy - (t) / 2)
+
+	if ((code >= 0x04 && code <= 0x0b) || (code >= 0x4c && code <= 0x4f)) {
+		u32 dashes = (code >= 0x4c) ? 2 : (code < 0x08) ? 3 : 4;
+		bool bold = code & 1, vertical = code & 2;
+		s32 t = bold ? heavy : light;
+		s32 len = vertical ? cellH : cellW;
+
+		for (u32 i = 0; i < dashes; i++) {
+			s32 start = len * i / dashes, end = len * (i + 1) / dashes;
+			s32 gap = MAX(1, (end - start) / 3);
+			start += gap / 2, end -= gap - gap / 2;
+
+			if (vertical) fill(SX(t), start, SX(t) + t, end);
+			else fill(start, SY(t), end, SY(t) + t);
+		}
+		return;
+	}
+
+	if (code >= 0x6d && code <= 0x70) {
+		// arcs: down and right, down and left, up and left, up and right
+		static const s8 arcSigns[4][2] = { { 1, 1 }, { -1, 1 }, { -1, -1 }, { 1, -1 } };
+		s32 sx = arcSigns[code - 0x6d][0], sy = arcSigns[code - 0x6d][1];
+
+		double x = SX(light) + light / 2.0, y = SY(light) + light / 2.0;
+		double rx = (sx > 0) ? cellW - x : x, ry = (sy > 0) ? cellH - y : y;
+		double r = (rx < ry) ? rx : ry;
+
+		double args[5] = { x + sx * r, y + sy * r, r, (double)-sx, (double)-sy };
+		stroke(arcDist, args, light);
+
+		// the straight rest of the longer side
+		s32 ex = (s32)(x + sx * r), ey = (s32)(y + sy * r);
+		if (sx > 0) fill(ex, SY(light), cellW, SY(light) + light);
+		else fill(0, SY(light), ex, SY(light) + light);
+		if (sy > 0) fill(SX(light), ey, SX(light) + light, cellH);
+		else fill(SX(light), 0, SX(light) + light, ey);
+		return;
+	}
+
+	if (code >= 0x71 && code <= 0x73) {
+		if (code != 0x72) {
+			double args[4] = { (double)cellW, 0, (double)-cellW, (double)cellH };
+			stroke(lineDist, args, light);
+		}
+		if (code != 0x71) {
+			double args[4] = { 0, 0, (double)cellW, (double)cellH };
+			stroke(lineDist, args, light);
+		}
+		return;
+	}
+
+	u8 arms = boxArms[code];
+	u32 up = arms >> 6, right = (arms >> 4) & 3, down = (arms >> 2) & 3, left = arms & 3;
+
+	// how far lines reach into the other axis, double lines are three light ones wide
+	s32 mh = MAX(THICK(left), THICK(right)), mv = MAX(THICK(up), THICK(down));
+	s32 bx = SX(light * 3), by = SY(light * 3);
+
+	// vertical lines crossing straight through, which split or stop the horizontal ones
+	bool passV = (up == Double && down == Double), passH = (left == Double && right == Double);
+
+	if (left == Light || left == Heavy) {
+		s32 t = THICK(left);
+		s32 end = right ? cellW : !mv ? SX(t) + t : passV ? bx + light : SX(mv) + mv;
+		fill(0, SY(t), end, SY(t) + t);
+	} else if (left == Double) {
+		s32 end = right ? cellW : mv ? SX(mv) + mv : cx;
+		fill(0, by, up == Double ? bx + light : end, by + light);
+		fill(0, by + light * 2, down == Double ? bx + light : end, by + light * 3);
+	}
+
+	if (right == Light || right == Heavy) {
+		s32 t = THICK(right);
+		s32 start = left ? 0 : !mv ? SX(t) : passV ? bx + light * 2 : SX(mv);
+		fill(start, SY(t), cellW, SY(t) + t);
+	} else if (right == Double) {
+		s32 start = left ? 0 : mv ? SX(mv) : cx;
+		fill(up == Double ? bx + light * 2 : start, by, cellW, by + light);
+		fill(down == Double ? bx + light * 2 : start, by + light * 2, cellW, by + light * 3);
+	}
+
+	if (up == Light || up == Heavy) {
+		s32 t = THICK(up);
+		s32 end = down ? cellH : !mh ? SY(t) + t : passH ? by + light : SY(mh) + mh;
+		fill(SX(t), 0, SX(t) + t, end);
+	} else if (up == Double) {
+		s32 end = down ? cellH : mh ? SY(mh) + mh : cy;
+		fill(bx, 0, bx + light, left == Double ? by + light : end);
+		fill(bx + light * 2, 0, bx + light * 3, right == Double ? by + light : end);
+	}
+
+	if (down == Light || down == Heavy) {
+		s32 t = THICK(down);
+		s32 start = up ? 0 : !mh ? SY(t) : passH ? by + light * 2 : SY(mh);
+		fill(SX(t), start, SX(t) + t, cellH);
+	} else if (down == Double) {
+		s32 start = up ? 0 : mh ? SY(mh) : cy;
+		fill(bx, left == Double ? by + light * 2 : start, bx + light, cellH);
+		fill(bx + light * 2, right == Double ? by + light * 2 : start, bx + light * 3, cellH);
+	}
+
+	#undef THICK
+	#undef SX
+	#undef SY
+}
+
+static void drawBlock(u32 code)
+{
+	// n eighths of a size
+	#define EIGHTHS(size, n) (((size) * (n) + 4) / 8)
+
+	if (code == 0x80) fill(0, 0, cellW, cellH / 2);
+	else if (code <= 0x88) fill(0, cellH - EIGHTHS(cellH, code - 0x80), cellW, cellH);
+	else if (code <= 0x8f) fill(0, 0, EIGHTHS(cellW, 0x90 - code), cellH);
+	else if (code == 0x90) fill(cellW / 2, 0, cellW, cellH);
+	else if (code <= 0x93) fill(0, 0, cellW, cellH, 0x40 * (code - 0x90));
+	else if (code == 0x94) fill(0, 0, cellW, EIGHTHS(cellH, 1));
+	else if (code == 0x95) fill(cellW - EIGHTHS(cellW, 1), 0, cellW, cellH);
+	else {
+		u8 quadrants = blockQuadrants[code - 0x96];
+		s32 hx = cellW / 2, hy = cellH / 2;
+
+		if (quadrants & 1) fill(0, 0, hx, hy);
+		if (quadrants & 2) fill(hx, 0, cellW, hy);
+		if (quadrants & 4) fill(0, hy, hx, cellH);
+		if (quadrants & 8) fill(hx, hy, cellW, cellH);
+	}
+
+	#undef EIGHTHS
+}
+
+static void drawBraille(u32 code)
+{
+	// dots 1 - 3 and 7 make up the left column, dots 4 - 6 and 8 the right one
+	static const u8 dotCol[8] = { 0, 0, 0, 1, 1, 1, 0, 1 };
+	static const u8 dotRow[8] = { 0, 1, 2, 0, 1, 2, 3, 3 };
+
+	s32 size = MAX(1, cellW / 4 < cellH / 8 ? cellW / 4 : cellH / 8);
+
+	for (u32 i = 0; i < 8; i++) {
+		if (!(code & (1 << i))) continue;
+
+		s32 x = (cellW * (dotCol[i] * 2 + 1) / 4) - size / 2;
+		s32 y = (cellH * (dotRow[i] * 2 + 1) / 8) - size / 2;
+		fill(x, y, x + size, y + size);
+	}
+}
+
+bool Font::isBoxChar(u32 unicode)
+{
+	return (unicode >= 0x2500 && unicode <= 0x259f) || (unicode >= 0x2800 && unicode <= 0x28ff);
+}
+
+void Font::drawBoxChar(u32 unicode, u8 *pixmap, u32 w, u32 h)
+{
+	cell = pixmap;
+	cellW = w, cellH = h;
+	memset(pixmap, 0, w * h);
+
+	if (unicode < 0x2580) drawBox(unicode - 0x2500);
+	else if (unicode < 0x25a0) drawBlock(unicode - 0x2500);
+	else drawBraille(unicode - 0x2800);
+}
@@ -41,6 +41,9 @@
 #define sw FW(Screen::instance()->cols())
 #define sh FH(Screen::instance()->rows())
 
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
 #define OFFSET(TYPE, MEMBER) ((size_t)(&(((TYPE *)0)->MEMBER)))
 #define MSG(a) ((Message *)(a))
 
@@ -54,6 +57,7 @@ ImProxy::ImProxy(FbShell *shell)
 
 	mValidWinNum = 0;
 	memset(&mWins, 0, sizeof(mWins));
+	memset(&mDamage, 0, sizeof(mDamage));
 
 	createImProcess();
 }
@@ -165,6 +169,14 @@ void ImProxy::changeTermMode(bool crlf, bool appkey, bool curo)
 
 void ImProxy::switchVt(bool enter, ImProxy *peer)
 {
+	// only the windows of the active shell are kept clear of terminal text
+	for (u32 i = 0; i < NR_IM_WINS; i++) {
+		Rectangle &rect = mWins[i];
+		Screen::instance()->setClipRect(i, rect.x, rect.y, enter ? rect.w : 0, rect.h);
+	}
+
+	memset(&mDamage, 0, sizeof(mDamage));
+
 	if (!mConnected || !mActive) return;
 
 	TtyInput::instance()->setRawMode(enter && mRawInput);
@@ -294,8 +306,31 @@ static IntersectState intersectRectangles(const Rectangle &r1, const Rectangle &
 	return Intersect;
 }
 
-void ImProxy::redrawImWin(const Rectangle &rect)
+void ImProxy::damageImWin(const Rectangle &rect)
 {
+	if (!rect.w || !rect.h) return;
+
+	if (!mDamage.w) {
+		mDamage = rect;
+		return;
+	}
+
+	u32 endx = MAX(mDamage.x + mDamage.w, rect.x + rect.w);
+	u32 endy = MAX(mDamage.y + mDamage.h, rect.y + rect.h);
+	mDamage.x = MIN(mDamage.x, rect.x);
+	mDamage.y = MIN(mDamage.y, rect.y);
+	mDamage.w = endx - mDamage.x;
+	mDamage.h = endy - mDamage.y;
+}
+
+void ImProxy::redrawImWin()
+{
+	if (!mDamage.w) return;
+
+	Rectangle rect = mDamage;
+	memset(&mDamage, 0, sizeof(mDamage));
+	if (FbShellManager::instance()->activeShell() != mShell) return;
+
 	for (u32 num = mValidWinNum, i = 0; num && i < NR_IM_WINS; i++) {
 		if (!mWins[i].w || !mWins[i].h) continue;
 		num--;
@@ -329,6 +364,7 @@ void ImProxy::setImWin(u32 id, Rectangle &rect)
 
 		memset(&mWins[id], 0, sizeof(rect));
 		mValidWinNum--;
+		Screen::instance()->setClipRect(id, 0, 0, 0, 0);
 
 		u32 endx = oldrect.x + oldrect.w, endy = oldrect.y + oldrect.h;
 		u16 col = oldrect.x / FW(1);
@@ -343,6 +379,7 @@ void ImProxy::setImWin(u32 id, Rectangle &rect)
 	mWins[id] = rect;
 
 	if (active) {
+		Screen::instance()->setClipRect(id, rect.x, rect.y, rect.w, rect.h);
 		Screen::instance()->enableScroll(!mValidWinNum);
 	}
 
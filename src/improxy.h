@@ -39,7 +39,9 @@ public:
 	void changeCursorPos(u16 col, u16 row);
 	void changeTermMode(bool crlf, bool appkey, bool curo);
 	void switchVt(bool enter, ImProxy *peer);
-	void redrawImWin(const Rectangle &rect);
+	// windows overlapped by terminal drawing in rect are repainted by the next redrawImWin()
+	void damageImWin(const Rectangle &rect);
+	void redrawImWin();
 
 private:
 	virtual void readyRead(s8 *buf, u32 len);
@@ -68,6 +70,7 @@ private:
 	typedef std::list<Message *> MsgList;
 	MsgList mWinMsgs[NR_IM_WINS];
 	Rectangle mWins[NR_IM_WINS];
+	Rectangle mDamage;
 };
 
 #endif
@@ -49,7 +49,11 @@ TtyInput *TtyInput::createInstance()
 		return 0;
 	}
 
-	if (!strstr(buf, "/dev/tty") && !strstr(buf, "/dev/vc")) {
+	// a memory screen can be driven from any terminal, such as a pseudo terminal
+	s8 mem[32];
+	Config::instance()->getOption("mem-screen", mem, sizeof(mem));
+
+	if (!*mem && !strstr(buf, "/dev/tty") && !strstr(buf, "/dev/vc")) {
 		fprintf(stderr, "stdin isn't a interactive tty!\n");
 		return 0;
 	}
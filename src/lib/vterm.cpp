@@ -64,6 +64,7 @@ VTerm::ModeFlag::ModeFlag()
 }
 
 u16 VTerm::history_lines;
+u32 VTerm::history_generations;
 u8 VTerm::control_map[MAX_CONTROL_CODE], VTerm::escape_map[NR_STATES][MAX_ESCAPE_CODE];
 
 void VTerm::init_state()
@@ -111,6 +112,8 @@ VTerm::VTerm(u16 w, u16 h)
 	history_full = false;
 	history_save_line = 0;
 	visual_start_line = 0;
+	history_serial = 0;
+	update_deferred = false;
 
 	reset();
 	resize(w, h);
@@ -140,12 +143,14 @@ void VTerm::reset()
 	esc_state = ESnormal;
 
 	pending_scroll = 0;
+	pending_top = pending_bot = 0;
 	scroll_top = 0;
 	scroll_bot = height ? (height - 1) : 0;
 	cursor_x = cursor_y = 0;
 	s_cursor_x = s_cursor_y = 0;
 
 	mode_flags = ModeFlag();
+	invalidateHistory();
 	char_attr = s_char_attr = default_char_attr;
 	cur_fcolor = default_char_attr.fcolor;
 	cur_bcolor = default_char_attr.bcolor;
@@ -163,6 +168,7 @@ void VTerm::reset()
 void VTerm::resize(u16 w, u16 h)
 {
 	if (!w || !h || (w == width && h == height)) return;
+	invalidateHistory();
 
 	u16 new_max_width = (w > max_width) ? w : max_width;
 	u16 new_max_height = (h > max_height) ? h : max_height;
@@ -410,6 +416,21 @@ void VTerm::input(const u8 *buf, u32 count)
 		do_control_char();
 	}
 
+	if (deferUpdate()) {
+		update_deferred = true;
+		return;
+	}
+
+	update_deferred = false;
+	update();
+	draw_cursor();
+}
+
+void VTerm::refresh()
+{
+	if (!update_deferred) return;
+	update_deferred = false;
+
 	update();
 	draw_cursor();
 }
@@ -485,17 +506,36 @@ void VTerm::update()
 	if (!width) return;
 
 	// first perform scroll-copy
-	s32 mx = scroll_bot - scroll_top + 1;
-	if (pending_scroll && pending_scroll< mx && -pending_scroll < mx) {
+	scroll_copy();
+
+	for (u16 i = 0; i < height; i++) {
+		if (dirty_endx[i] >= dirty_startx[i]) {
+			requestUpdate(dirty_startx[i], i, dirty_endx[i] - dirty_startx[i] + 1, 1);
+			dirty_startx[i] = width;
+			dirty_endx[i] = 0;
+		}
+	}
+}
+
+void VTerm::scroll_copy()
+{
+	// done with before moveChars(), whose redraw of the lines around a panned region may come
+	// back to update()
+	if (pending_bot >= height) pending_bot = height - 1;
+	s32 mx = pending_bot - pending_top + 1;
+	s32 pending = pending_scroll;
+	pending_scroll = 0;
+
+	if (pending && pending < mx && -pending < mx) {
 		u16 sy, dy, h;
-		if (pending_scroll < 0) {
-			sy = scroll_top;
-			dy = scroll_top - pending_scroll;
-			h = scroll_bot - scroll_top + pending_scroll + 1;
+		if (pending < 0) {
+			sy = pending_top;
+			dy = pending_top - pending;
+			h = pending_bot - pending_top + pending + 1;
 		} else {
-			sy = scroll_top + pending_scroll;
-			dy = scroll_top;
-			h = scroll_bot - scroll_top - pending_scroll + 1;
+			sy = pending_top + pending;
+			dy = pending_top;
+			h = pending_bot - pending_top - pending + 1;
 		}
 
 		if (!moveChars(0, sy, 0, dy, width, h)) {
@@ -506,15 +546,6 @@ void VTerm::update()
 			}
 		}
 	}
-	pending_scroll = 0;
-
-	for (u16 i = 0; i < height; i++) {
-		if (dirty_endx[i] >= dirty_startx[i]) {
-			requestUpdate(dirty_startx[i], i, dirty_endx[i] - dirty_startx[i] + 1, 1);
-			dirty_startx[i] = width;
-			dirty_endx[i] = 0;
-		}
-	}
 }
 
 void VTerm::draw_cursor()
@@ -536,6 +567,8 @@ void VTerm::requestUpdate(u16 x, u16 y, u16 w, u16 h)
 
 void VTerm::expose(u16 x, u16 y, u16 w, u16 h)
 {
+	// a pending scroll-copy must not be applied on top of freshly drawn text
+	refresh();
 	if (!width || !w || !h || x >= width || y >= height) return;
 
 	if (x + w > width) w = width - x;
@@ -550,29 +583,39 @@ void VTerm::expose(u16 x, u16 y, u16 w, u16 h)
 		if (attrs[yp + startx].type == CharAttr::DoubleRight) startx--;
 		if (attrs[yp + endx].type == CharAttr::DoubleLeft) endx++;
 
-		CharAttr attr = attrs[yp + startx];
 		bool dws[width];
 		u16 codes[width], num = 0;
-		u16 cur, start = startx;
+		CharAttr lineAttrs[width];
 
-		for (cur = startx; cur <= endx; cur++) {
+		for (u16 cur = startx; cur <= endx; cur++) {
 			if (attrs[yp + cur].type == CharAttr::DoubleRight) continue;
 
-			if (attrs[yp + cur] != attr) {
-				attr.reverse ^= mode_flags.inverse_screen;
-				drawChars(attr, start, y, cur - start, num, codes, dws);
-
-				num = 0;
-				start = cur;
-				attr = attrs[yp + cur];
-			}
-
+			lineAttrs[num] = attrs[yp + cur];
+			lineAttrs[num].reverse ^= mode_flags.inverse_screen;
 			dws[num] = (attrs[yp + cur].type != CharAttr::Single);
 			codes[num++] = text[yp + cur];
 		}
 
-		attr.reverse ^= mode_flags.inverse_screen;
-		drawChars(attr, start, y, cur - start, num, codes, dws);
+		drawLine(startx, y, num, codes, dws, lineAttrs);
+	}
+}
+
+void VTerm::drawLine(u16 x, u16 y, u16 num, u16 *chars, bool *dws, CharAttr *attrs)
+{
+	if (!num) return;
+	u16 start = 0, startx = x;
+
+	for (u16 i = 0; i <= num; i++) {
+		if (i < num && !(attrs[i] != attrs[start])) {
+			x += dws[i] ? 2 : 1;
+			continue;
+		}
+
+		drawChars(attrs[start], startx, y, x - startx, i - start, chars + start, dws + start);
+
+		start = i;
+		startx = x;
+		if (i < num) x += dws[i] ? 2 : 1;
 	}
 }
 
@@ -582,6 +625,7 @@ void VTerm::inverse(u16 sx, u16 sy, u16 ex, u16 ey)
 	if (charAttr(sx, sy).type == CharAttr::DoubleRight) sx--;
 	if (charAttr(ex, ey).type == CharAttr::DoubleLeft) ex++;
 	if (sy == ey && sx > ex) return;
+	invalidateHistory();
 
 	for (u16 y = sy; y <= ey; y++) {
 		u32 yp = get_line(y) * max_width;
@@ -596,7 +640,7 @@ void VTerm::inverse(u16 sx, u16 sy, u16 ex, u16 ey)
 
 void VTerm::scroll_region(u16 start_y, u16 end_y, s16 num)
 {
-	s32 y, takey, fast_scroll, mx, clr;
+	s32 y, takey, mx, clr;
 	u16 temp[height];
 	u16 temp_sx[height], temp_ex[height];
 
@@ -612,15 +656,18 @@ void VTerm::scroll_region(u16 start_y, u16 end_y, s16 num)
 		history_scroll(num);
 	}
 
-	fast_scroll = (start_y == scroll_top && end_y == scroll_bot);
+	// scrolls of the same lines add up and are copied on screen at once by update(),
+	// one of other lines has to wait until the pending one is copied, the lines are
+	// still drawn with the next update(), which deferUpdate() may put off to the next frame
+	if (pending_scroll && (start_y != pending_top || end_y != pending_bot)) scroll_copy();
 
-	if (fast_scroll) pending_scroll += num;
+	pending_scroll += num;
+	pending_top = start_y;
+	pending_bot = end_y;
 
 	memcpy(temp, linenumbers, sizeof(temp));
-	if (fast_scroll) {
-		memcpy(temp_sx, dirty_startx, sizeof(temp_sx));
-		memcpy(temp_ex, dirty_endx, sizeof(temp_ex));
-	}
+	memcpy(temp_sx, dirty_startx, sizeof(temp_sx));
+	memcpy(temp_ex, dirty_endx, sizeof(temp_ex));
 
 	// move the lines by renumbering where they point to
 	if (num<mx && -num<mx) {
@@ -632,7 +679,7 @@ void VTerm::scroll_region(u16 start_y, u16 end_y, s16 num)
 
 			linenumbers[y] = temp[takey];
 
-			if (!fast_scroll || clr) {
+			if (clr) {
 				dirty_startx[y] = 0;
 				dirty_endx[y] = width-1;
 			} else {
@@ -765,6 +812,7 @@ void VTerm::history_scroll(u16 num)
 			}
 		}
 
+		history_serial++;
 		history_save_line++;
 		if (history_save_line == history_lines) {
 			history_save_line = 0;
@@ -779,6 +827,7 @@ void VTerm::history_scroll(u16 num)
 void VTerm::historyDisplay(bool absolute, s32 num)
 {
 	if (!history_lines || (absolute && num == (s32)visual_start_line) || (!absolute && !num)) return;
+	refresh();
 
 	u32 bak_line = visual_start_line;
 
@@ -823,6 +872,27 @@ void VTerm::historyDisplay(bool absolute, s32 num)
 	draw_cursor();
 }
 
+bool VTerm::historyLine(u16 x, u16 y, u16 num, bool *dws, u32 &line, u32 &generation)
+{
+	u32 total = total_history_lines();
+	if (x || y >= height || visual_start_line + y >= total) return false;
+
+	u16 cells = 0;
+	for (u16 i = 0; i < num; i++) {
+		cells += dws[i] ? 2 : 1;
+	}
+	if (cells != width) return false;
+
+	line = history_serial - total + visual_start_line + y;
+	generation = history_generation;
+	return true;
+}
+
+void VTerm::invalidateHistory()
+{
+	history_generation = ++history_generations;
+}
+
 u16 VTerm::get_line(u16 y)
 {
 	if (y > height) y = height;
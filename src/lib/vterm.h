@@ -81,6 +81,7 @@ public:
 	u16 mode(ModeType type);
 	void resize(u16 w, u16 h);
 	void input(const u8 *buf, u32 count);
+	void refresh();
 	void expose(u16 x, u16 y, u16 w, u16 h);
 	void inverse(u16 sx, u16 sy, u16 ex, u16 ey);
 
@@ -91,6 +92,8 @@ public:
 
 protected:
 	virtual void drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws) = 0;
+	// a whole line with one attribute for each char, split into drawChars() calls unless overridden
+	virtual void drawLine(u16 x, u16 y, u16 num, u16 *chars, bool *dws, CharAttr *attrs);
 	virtual bool moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h) { return false; }
 	virtual void drawCursor(CharAttr attr, u16 x, u16 y, u16 c) {}
 	virtual void sendBack(const s8 *data) {}
@@ -98,6 +101,14 @@ protected:
 	virtual void historyChanged(u32 cur, u32 total) {}
 	virtual void request(RequestType type, u32 val = 0) {}
 	virtual void requestUpdate(u16 x, u16 y, u16 w, u16 h);
+	virtual bool deferUpdate() { return false; }
+
+	// history lines are numbered in the order they were saved, a line keeps looking the same
+	// while the generation stays, false for the lines of the screen itself and for cells which
+	// don't make up the whole line
+	bool historyLine(u16 x, u16 y, u16 num, bool *dws, u32 &line, u32 &generation);
+	// something VTerm doesn't know about, such as the palette, changed the look of history lines
+	void invalidateHistory();
 
 private:
 	// utility functions
@@ -109,6 +120,8 @@ private:
 	void changed_line(u16 y, u16 start_x, u16 end_x);
 	void move_cursor(u16 x, u16 y);
 	void update();
+	// the pending scroll copied on screen, the lines it leaves dirty are drawn by update()
+	void scroll_copy();
 	void draw_cursor();
 	u16 get_line(u16 y);
 	u16 total_history_lines() { return history_full ? history_lines : history_save_line; }
@@ -232,6 +245,8 @@ private:
 	u16 width, height, max_width, max_height;
 	u16 scroll_top, scroll_bot;
 	s32 pending_scroll; // >0 means scroll up
+	u16 pending_top, pending_bot; // the lines pending_scroll applies to
+	bool update_deferred; // input has been parsed but not drawn yet, see refresh()
 
 	// terminal state
 	struct ModeFlag {
@@ -271,6 +286,9 @@ private:
 	static u16 history_lines;
 	bool history_full;
 	u32 history_save_line, visual_start_line;
+	// lines ever saved to history, and what they look like, unique among all VTerms
+	u32 history_serial, history_generation;
+	static u32 history_generations;
 };
 
 #endif
@@ -361,8 +361,6 @@ void VTerm::set_margins()
 	b = param[1];
 	if (b < 1 || b > height) b = height;
 
-	if (pending_scroll) update();
-
 	scroll_top = t - 1;
 	scroll_bot = b - 1;
 	if (cursor_y < scroll_top) move_cursor(cursor_x, scroll_top);
@@ -419,6 +417,7 @@ void VTerm::enable_mode(bool enable)
 		break;
 	case 1005 :
 		mode_flags.inverse_screen = enable;
+		invalidateHistory();
 		for (u16 i = 0; i < height; i++) {
 			changed_line(i, 0, width - 1);
 		}
@@ -0,0 +1,213 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "memdev.h"
+#include "screen_simd.h"
+#include "fbconfig.h"
+
+static u8 *vmem;
+static u32 vmemSize;
+
+// where the shown screen starts, as a frame buffer device would be told by FBIOPAN_DISPLAY
+static u32 displayLine, displayColumn;
+static Color colormap[NR_COLORS];
+static bool leaving;
+
+MemDev *MemDev::initMemDev(const s8 *mode)
+{
+	u32 width, height, bpp;
+	if (sscanf(mode, "%ux%ux%u", &width, &height, &bpp) != 3 || !width || !height
+		|| width > 8192 || height > 8192) {
+		fprintf(stderr, "memory screen mode should be WIDTHxHEIGHTxBPP!\n");
+		return 0;
+	}
+
+	if (bpp != 8 && bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32) {
+		fprintf(stderr, "only support memory screen with 8/15/16/24/32 color depth!\n");
+		return 0;
+	}
+
+	return new MemDev(width, height, bpp);
+}
+
+MemDev::MemDev(u32 width, u32 height, u32 bpp)
+{
+	u32 bytes = (bpp == 15) ? 2 : (bpp >> 3);
+
+	mWidth = width;
+	mHeight = height;
+	mBitsPerPixel = bpp;
+	mBytesPerLine = width * bytes;
+	defaultLayout(bpp, mLayout);
+
+	u32 lines = height;
+
+	bool pageflip = false;
+	Config::instance()->getOption("page-flip", pageflip);
+
+	s8 pan[16];
+	Config::instance()->getOption("mem-screen-pan", pan, sizeof(pan));
+	bool upright = (mRotateType == Rotate0 || mRotateType == Rotate180);
+
+	// panning as the drivers offer it, over video memory twice the size of the screen
+	if (pageflip) {
+		mPageLines = height;
+		lines = height * 2;
+	} else if (upright && !strcmp(pan, "ypan")) {
+		mScrollType = YPan;
+		lines = height * 2;
+		mOffsetMax = lines - height;
+	} else if (upright && !strcmp(pan, "ywrap")) {
+		mScrollType = YWrap;
+		lines = height * 2;
+		mOffsetMax = lines - 1;
+	} else if (!upright && !strcmp(pan, "xpan")) {
+		mScrollType = XPan;
+		mOffsetMax = width;
+		mBytesPerLine += width * bytes;
+	}
+
+	vmemSize = mBytesPerLine * lines;
+	vmem = new u8[vmemSize];
+
+	// no program has drawn a background image in system memory, a fixed pattern stands in for it
+	if (getenv("FBTERM_BACKGROUND_IMAGE")) {
+		for (u32 i = 0; i < vmemSize; i++) {
+			vmem[i] = i % mBytesPerLine * 3 + i / mBytesPerLine * 5;
+		}
+	} else {
+		memset(vmem, 0, vmemSize);
+	}
+	mVMemBase = vmem;
+	displayLine = displayColumn = 0;
+}
+
+MemDev::~MemDev()
+{
+	delete[] vmem;
+}
+
+const s8 *MemDev::drvId()
+{
+	return "memory";
+}
+
+void MemDev::setupOffset()
+{
+	s8 *name = getenv("FRAMEBUFFER");
+	if (leaving && name) {
+		u32 width, height, pitch;
+		frameSize(width, height, pitch);
+
+		u8 *frame = new u8[pitch * height];
+		shownFrame(frame);
+		writeImage(name, frame);
+		delete[] frame;
+	}
+
+	if (mScrollType == XPan) {
+		displayColumn = mOffsetCur;
+	} else {
+		displayLine = mOffsetCur + mFrontPage * mPageLines;
+	}
+}
+
+void MemDev::switchVc(bool enter)
+{
+	// leaving the VT is the last time the screen is shown, it is taken before setupOffset() goes
+	// back to offset 0
+	leaving = !enter;
+	Screen::switchVc(enter);
+	leaving = false;
+}
+
+void MemDev::setupPalette(bool restore)
+{
+	if (restore || !mPalette) return;
+	memcpy(colormap, mPalette, sizeof(colormap));
+}
+
+void MemDev::frameSize(u32 &width, u32 &height, u32 &pitch)
+{
+	// video memory as a monitor would show it, mWidth and mHeight have been swapped for a rotated screen
+	bool upright = (mRotateType == Rotate0 || mRotateType == Rotate180);
+	width = upright ? mWidth : mHeight;
+	height = upright ? mHeight : mWidth;
+	pitch = width * ((mBitsPerPixel == 15) ? 2 : (mBitsPerPixel >> 3));
+}
+
+void MemDev::shownFrame(u8 *frame)
+{
+	u32 width, height, pitch;
+	frameSize(width, height, pitch);
+
+	u32 lines = vmemSize / mBytesPerLine;
+	u32 x = displayColumn * (pitch / width);
+
+	for (u32 y = 0; y < height; y++, frame += pitch) {
+		memcpy(frame, vmem + ((displayLine + y) % lines) * mBytesPerLine + x, pitch);
+	}
+}
+
+void MemDev::writeImage(const s8 *name, const u8 *frame)
+{
+	FILE *file = fopen(name, "wb");
+	if (!file) {
+		fprintf(stderr, "can't write memory screen to %s!\n", name);
+		return;
+	}
+
+	u32 width, height, pitch;
+	frameSize(width, height, pitch);
+	u32 bytes = pitch / width;
+
+	fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+	u8 *rgb = new u8[width * 3];
+	for (u32 y = 0; y < height; y++) {
+		const u8 *src = frame + y * pitch;
+
+		for (u32 x = 0; x < width; x++, src += bytes) {
+			u32 pixel = 0;
+			for (u32 i = 0; i < bytes; i++) {
+				pixel |= src[i] << (i * 8);
+			}
+
+			u8 *dst = rgb + x * 3;
+			if (mBitsPerPixel == 8) {
+				dst[0] = colormap[pixel].red;
+				dst[1] = colormap[pixel].green;
+				dst[2] = colormap[pixel].blue;
+			} else {
+				dst[0] = unpackField(pixel, mLayout.red);
+				dst[1] = unpackField(pixel, mLayout.green);
+				dst[2] = unpackField(pixel, mLayout.blue);
+			}
+		}
+
+		fwrite(rgb, 3, width, file);
+	}
+
+	delete[] rgb;
+	fclose(file);
+}
@@ -0,0 +1,46 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef MEMDEV_H
+#define MEMDEV_H
+
+#include "screen.h"
+
+// a screen in system memory, for running fbterm without a display
+class MemDev : public Screen {
+private:
+	friend class Screen;
+	friend class RenderCheck;
+	static MemDev *initMemDev(const s8 *mode);
+
+	MemDev(u32 width, u32 height, u32 bpp);
+	~MemDev();
+
+	virtual void setupOffset();
+	virtual void setupPalette(bool restore);
+	virtual void switchVc(bool enter);
+	virtual const s8 *drvId();
+
+	// the shown screen, as frameSize() lines of pitch bytes
+	void frameSize(u32 &width, u32 &height, u32 &pitch);
+	void shownFrame(u8 *frame);
+	void writeImage(const s8 *name, const u8 *frame);
+};
+#endif
@@ -110,6 +110,10 @@ void Mouse::readyRead(s8 *buf, u32 len)
 	len /= sizeof(Gpm_Event);
 	Gpm_Event *ev = (Gpm_Event *)buf;
 
+	// moves of one batch are merged into one, unless something else happens in between
+	bool moved = false;
+	s32 moveButtons = 0;
+
 	for (; len--; ev++) {
 		s32 type = -1, buttons = 0;
 
@@ -135,10 +139,23 @@ void Mouse::readyRead(s8 *buf, u32 len)
 		if (newy >= maxy) newy = maxy - 1;
 		if (newx == x && newy == y && !(buttons & MouseButtonMask)) continue;
 
-		shell->mouseInput(newx, newy, type, buttons);
+		if (moved && (type != Move || buttons != moveButtons)) {
+			shell->mouseInput(x, y, Move, moveButtons);
+			moved = false;
+		}
+
+		if (type == Move) {
+			moved = true;
+			moveButtons = buttons;
+		} else {
+			shell->mouseInput(newx, newy, type, buttons);
+		}
+
 		x = newx;
 		y = newy;
 	}
+
+	if (moved) shell->mouseInput(x, y, Move, moveButtons);
 }
 
 void Mouse::switchVc(bool enter)
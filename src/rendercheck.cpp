@@ -0,0 +1,499 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fontconfig/fontconfig.h>
+#include "rendercheck.h"
+#include "memdev.h"
+#include "fbshell.h"
+#include "font.h"
+#include "fbconfig.h"
+
+#define CHECK_WIDTH 640
+#define CHECK_HEIGHT 480
+#define NR_STEPS 8
+
+// the corpus is drawn with these whatever the user has configured, so that every machine draws the same
+// frames, the second one has the wide glyphs
+#define CHECK_FONT "DejaVu Sans Mono"
+#define CHECK_WIDE_FONT "Noto Sans Mono CJK SC"
+
+// everything which picks a faster rendering path, turned off
+static const s8 * const plainOptions[] = {
+	"font-names", CHECK_FONT "," CHECK_WIDE_FONT,
+	"font-size", "16",
+	"render-simd", "no",
+	"color-cache-size", "0",
+	"history-cache-size", "0",
+	"render-threads", "1",
+	"shadow-buffer", "no",
+	"page-flip", "no",
+	"rotate-on-flush", "no",
+	"pad-glyphs", "no",
+	"mem-screen-pan", "none",
+	"max-fps", "0",
+	"glyph-cache-size", "0",
+	"glyph-cache-file", "no",
+	0
+};
+
+static const struct {
+	const s8 *name;
+	// bit n set for rotation n, the pans only come into play for some of them
+	u32 rotations;
+	const s8 *options[15];
+	// glyph files are removed first, so that the variant writes them instead of reading them
+	bool newGlyphFiles;
+} variants[] = {
+	{ "simd", 0xf, { "render-simd", "avx2", 0 } },
+	{ "sse2", 0xf, { "render-simd", "sse2", 0 } },
+	{ "color-cache", 0xf, { "color-cache-size", "2048", 0 } },
+	{ "simd-color-cache", 0xf, { "render-simd", "avx2", "color-cache-size", "2048", 0 } },
+	{ "pad-glyphs", 0xf, { "render-simd", "avx2", "color-cache-size", "2048", "pad-glyphs", "yes", 0 } },
+	{ "threads", 0xf, { "render-threads", "4", 0 } },
+	{ "glyph-eviction", 0xf, { "glyph-cache-size", "1", "render-threads", "4", 0 } },
+	{ "glyph-cache-file-write", 0xf, { "glyph-cache-file", "yes", "render-threads", "4", 0 }, true },
+	{ "glyph-cache-file", 0xf, { "glyph-cache-file", "yes", "render-threads", "4", 0 } },
+	{ "shadow", 0xf, { "shadow-buffer", "yes", 0 } },
+	{ "history-cache", 0xf, { "shadow-buffer", "yes", "history-cache-size", "1024", 0 } },
+	{ "page-flip", 0xf, { "page-flip", "yes", 0 } },
+	{ "frames", 0xf, { "max-fps", "60", 0 } },
+	{ "ypan-frames", 0x5, { "mem-screen-pan", "ypan", "max-fps", "60", 0 } },
+	{ "ypan", 0x5, { "mem-screen-pan", "ypan", 0 } },
+	{ "ywrap", 0x5, { "mem-screen-pan", "ywrap", 0 } },
+	{ "xpan", 0xa, { "mem-screen-pan", "xpan", 0 } },
+	{ "rotate-on-flush", 0xa, { "rotate-on-flush", "yes", 0 } },
+	{ "all", 0xf, { "render-simd", "avx2", "color-cache-size", "2048", "pad-glyphs", "yes",
+		"render-threads", "4", "shadow-buffer", "yes", "history-cache-size", "1024", "max-fps", "60", 0 } },
+};
+
+#define NR_VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static Color palette[NR_COLORS];
+static Screen *screen;
+// output is drawn once a step, as FbShellManager paces it to frames
+static bool deferFrames;
+// the corpus is drawn over the pattern MemDev puts in video memory as a background image
+static bool backgroundImage;
+
+static void initPalette()
+{
+	static const u8 ansi[16][3] = {
+		{ 0x00, 0x00, 0x00 }, { 0xaa, 0x00, 0x00 }, { 0x00, 0xaa, 0x00 }, { 0xaa, 0x55, 0x00 },
+		{ 0x00, 0x00, 0xaa }, { 0xaa, 0x00, 0xaa }, { 0x00, 0xaa, 0xaa }, { 0xaa, 0xaa, 0xaa },
+		{ 0x55, 0x55, 0x55 }, { 0xff, 0x55, 0x55 }, { 0x55, 0xff, 0x55 }, { 0xff, 0xff, 0x55 },
+		{ 0x55, 0x55, 0xff }, { 0xff, 0x55, 0xff }, { 0x55, 0xff, 0xff }, { 0xff, 0xff, 0xff },
+	};
+	static const u8 levels[6] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
+
+	for (u32 i = 0; i < NR_COLORS; i++) {
+		Color &c = palette[i];
+
+		if (i < 16) {
+			c.red = ansi[i][0];
+			c.green = ansi[i][1];
+			c.blue = ansi[i][2];
+		} else if (i < 232) {
+			c.red = levels[(i - 16) / 36];
+			c.green = levels[(i - 16) / 6 % 6];
+			c.blue = levels[(i - 16) % 6];
+		} else {
+			c.red = c.green = c.blue = 8 + (i - 232) * 10;
+		}
+	}
+}
+
+// fontconfig gives a substitute for a family it doesn't have, which doesn't count here
+static bool findFont(const s8 *family)
+{
+	FcPattern *pat = FcNameParse((const FcChar8 *)family);
+	FcConfigSubstitute(NULL, pat, FcMatchPattern);
+	FcDefaultSubstitute(pat);
+
+	FcResult result;
+	FcPattern *match = FcFontMatch(NULL, pat, &result);
+	FcChar8 *name = 0;
+	bool found = match && FcPatternGetString(match, FC_FAMILY, 0, &name) == FcResultMatch
+		&& !strcasecmp((const s8 *)name, family);
+
+	if (match) FcPatternDestroy(match);
+	FcPatternDestroy(pat);
+	return found;
+}
+
+static void removeGlyphFiles(const s8 *cache)
+{
+	s8 dir[256], file[512];
+	snprintf(dir, sizeof(dir), "%s/fbterm", cache);
+
+	DIR *entries = opendir(dir);
+	if (!entries) return;
+
+	for (dirent *entry; (entry = readdir(entries));) {
+		if (entry->d_name[0] == '.') continue;
+
+		snprintf(file, sizeof(file), "%s/%s", dir, entry->d_name);
+		unlink(file);
+	}
+
+	closedir(entries);
+}
+
+s32 RenderCheck::run()
+{
+	if (!findFont(CHECK_FONT)) {
+		printf("render-check: font %s isn't installed, the check is skipped\n", CHECK_FONT);
+		return 77;
+	}
+	bool wideFont = findFont(CHECK_WIDE_FONT);
+
+	// glyph files are kept in a directory of the check's own rather than the user's cache
+	s8 cache[] = "/tmp/fbterm-render-check-XXXXXX";
+	if (!mkdtemp(cache)) {
+		printf("render-check: can't make a directory for glyph files\n");
+		return 1;
+	}
+
+	const s8 *userCache = getenv("XDG_CACHE_HOME");
+	s8 *savedCache = userCache ? strdup(userCache) : 0;
+	setenv("XDG_CACHE_HOME", cache, 1);
+
+	// Screen writes escapes for the console to stdin, keep them off the terminal the report goes to
+	s32 console = dup(STDIN_FILENO);
+	s32 null = open("/dev/null", O_RDWR);
+	if (null >= 0) {
+		dup2(null, STDIN_FILENO);
+		close(null);
+	}
+
+	initPalette();
+
+	static const u32 depths[] = { 8, 15, 16, 24, 32 };
+	u32 configs = 0, frames = 0, differ = 0, failed = 0;
+
+	// every path is checked once on a black screen and once over a background image, which
+	// they blend with
+	for (u32 bg = 0; bg < 2; bg++) {
+		backgroundImage = bg;
+		if (bg) setenv("FBTERM_BACKGROUND_IMAGE", "1", 1);
+		else unsetenv("FBTERM_BACKGROUND_IMAGE");
+
+		for (u32 d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+			u32 bytes = (depths[d] == 15) ? 2 : (depths[d] >> 3);
+			u8 *reference = new u8[CHECK_WIDTH * CHECK_HEIGHT * bytes * NR_STEPS];
+
+			for (u32 rotate = Rotate0; rotate <= Rotate270; rotate++) {
+				if (renderCorpus(depths[d], rotate, 0, 0, reference) < 0) {
+					failed++;
+					continue;
+				}
+
+				for (u32 v = 0; v < NR_VARIANTS; v++) {
+					if (!(variants[v].rotations & (1 << rotate))) continue;
+					if (variants[v].newGlyphFiles) removeGlyphFiles(cache);
+
+					s32 num = renderCorpus(depths[d], rotate, variants[v].name, variants[v].options, reference);
+					if (num < 0) {
+						failed++;
+						continue;
+					}
+
+					configs++;
+					frames += NR_STEPS;
+					differ += num;
+				}
+			}
+
+			delete[] reference;
+		}
+	}
+
+	unsetenv("FBTERM_BACKGROUND_IMAGE");
+
+	removeGlyphFiles(cache);
+	s8 dir[256];
+	snprintf(dir, sizeof(dir), "%s/fbterm", cache);
+	rmdir(dir);
+	rmdir(cache);
+
+	if (savedCache) {
+		setenv("XDG_CACHE_HOME", savedCache, 1);
+		free(savedCache);
+	} else {
+		unsetenv("XDG_CACHE_HOME");
+	}
+
+	if (console >= 0) {
+		dup2(console, STDIN_FILENO);
+		close(console);
+	}
+
+	printf("render-check: %u configurations, %u frames compared, %u differ", configs, frames, differ);
+	if (failed) printf(", %u screens couldn't be set up", failed);
+	if (!wideFont) printf(", font %s isn't installed and wide glyphs were left out", CHECK_WIDE_FONT);
+	printf("\n");
+
+	return (differ || failed) ? 1 : 0;
+}
+
+// draws the corpus with options on top of plainOptions, the frames are copied to frames for the
+// plain path, which has no name, or compared with them otherwise. returns the number of frames
+// which differ, or -1 when the screen can't be set up
+s32 RenderCheck::renderCorpus(u32 depth, u32 rotate, const s8 *name, const s8 * const *options, u8 *frames)
+{
+	// Config keeps the strings
+	static s8 mode[32], rotation[4];
+	snprintf(mode, sizeof(mode), "%ux%ux%u", CHECK_WIDTH, CHECK_HEIGHT, depth);
+	snprintf(rotation, sizeof(rotation), "%u", rotate);
+
+	Config *config = Config::instance();
+	config->setOption("mem-screen", mode);
+	config->setOption("screen-rotate", rotation);
+
+	for (const s8 * const *opt = plainOptions; *opt; opt += 2) {
+		config->setOption(opt[0], opt[1]);
+	}
+	for (; options && *options; options += 2) {
+		config->setOption(options[0], options[1]);
+	}
+
+	u32 fps = 0;
+	config->getOption("max-fps", fps);
+	deferFrames = (fps != 0);
+
+	MemDev *mem = (MemDev *)Screen::instance();
+	if (!mem) return -1;
+	screen = mem;
+
+	screen->setPalette(palette);
+	screen->switchVc(true);
+
+	u32 width, height, pitch;
+	mem->frameSize(width, height, pitch);
+	u32 frameBytes = pitch * height;
+
+	u8 *frame = new u8[frameBytes];
+	RenderCheck *term = new RenderCheck(screen->cols(), screen->rows());
+	s32 differ = 0;
+
+	for (u32 step = 0; step < NR_STEPS; step++) {
+		term->playStep(step);
+		term->refresh();
+		screen->flush();
+
+		u8 *expected = frames + step * frameBytes;
+		if (!name) {
+			mem->shownFrame(expected);
+			continue;
+		}
+
+		mem->shownFrame(frame);
+		if (!memcmp(frame, expected, frameBytes)) continue;
+
+		differ++;
+
+		const s8 *bg = backgroundImage ? "-bg" : "";
+
+		s8 file[64];
+		snprintf(file, sizeof(file), "render-check-%u-%u%s-plain-%u.ppm", depth, rotate, bg, step);
+		mem->writeImage(file, expected);
+		snprintf(file, sizeof(file), "render-check-%u-%u%s-%s-%u.ppm", depth, rotate, bg, name, step);
+		mem->writeImage(file, frame);
+
+		printf("render-check: %u bpp, rotation %u, %s%s: frame %u differs, written to %s\n", depth, rotate, name,
+			backgroundImage ? " over a background image" : "", step, file);
+	}
+
+	delete term;
+	delete[] frame;
+
+	Screen::uninstance();
+	screen = 0;
+	return differ;
+}
+
+void RenderCheck::playStep(u32 step)
+{
+	static s8 buf[16384];
+	s8 *p = buf;
+
+	switch (step) {
+	case 0:
+		// attributes, every pair of the 16 colors, and the 256 color palette
+		p += sprintf(p, "\e[H\e[2Jplain \e[1mbold\e[0m \e[2mhalf-bright\e[0m \e[3mitalic\e[0m \e[4munderline\e[0m "
+			"\e[5mblink\e[0m \e[7mreverse\e[0m \e[1;5;7mall of them\e[0m\r\n");
+
+		for (u32 bc = 0; bc < 16; bc++) {
+			for (u32 fc = 0; fc < 16; fc++) {
+				p += sprintf(p, "\e[1;%u}\e[2;%u}%X", fc, bc, fc);
+			}
+			p += sprintf(p, "\e[0m ");
+
+			for (u32 c = 0; c < 16; c++) {
+				p += sprintf(p, "\e[2;%u} ", 16 + bc * 16 + c);
+			}
+			p += sprintf(p, "\e[0m\r\n");
+		}
+		break;
+
+	case 1:
+		// wide and drawn glyphs, ending up on odd and even columns
+		p += sprintf(p, "\e[H\e[2J");
+		for (u32 i = 0; i < 2; i++) {
+			p += sprintf(p, "%s\e[31m中文字符\e[32m日本語\e[33m한국어\e[0m àéîõü ½ ±×÷\r\n", i ? " " : "");
+			p += sprintf(p, "%s┌─┬─┐ ╔═╦═╗ ╭─╮ ┏━┳━┓ ▀▄█▌▐ ░▒▓ ⠁⠃⠇⡇⣿ ╱╲╳\r\n", i ? " " : "");
+			p += sprintf(p, "%s├─┼─┤ ╠═╬═╣ │ │ ┣━╋━┫ ▖▗▘▙▚▛\r\n", i ? " " : "");
+			p += sprintf(p, "%s└─┴─┘ ╚═╩═╝ ╰─╯ ┗━┻━┛ ▁▂▃▄▅▆▇\r\n", i ? " " : "");
+		}
+		p += sprintf(p, "\e[7m中文 ┼ ⣿\e[0m \e[4m中文 ┼ ⣿\e[0m\r\n");
+		break;
+
+	case 2:
+		// enough lines to scroll, and to fill history for the pages below
+		for (u32 i = 0; i < h() * 3u; i++) {
+			p += sprintf(p, "\e[1;%u}line %u of scrolled text,\e[2;%u} colors change every line\e[0m\r\n", i % 16, i, 16 + i % 216);
+		}
+		break;
+
+	case 3: {
+		// a scroll region, and text inserted, deleted and erased, each drawn before the next one
+		static const s8 * const edits[] = {
+			"\e[r\e[0m\e[4;1H\e[2L", "\e[6;5H\e[3M", "\e[8;3H\e[4P", "\e[9;10H\e[5@", "\e[10;20H\e[K",
+			"\e[11;30H\e[1K", "\e[12;1H\e[7X", "\e[2;1H\e[1J",
+		};
+
+		p += sprintf(p, "\e[3;%ur\e[%u;1H", h() - 3, h() - 3);
+		for (u32 i = 0; i < 10; i++) {
+			p += sprintf(p, "\e[2;%u}region line %u\r\n", 1 + i % 6, i);
+			input((const u8 *)buf, p - buf);
+			p = buf;
+		}
+
+		for (u32 i = 0; i < sizeof(edits) / sizeof(edits[0]); i++) {
+			input((const u8 *)edits[i], strlen(edits[i]));
+		}
+
+		p += sprintf(p, "\e[%u;40H\e[0J\e[%u;%uH中", h() - 2, h() / 2, w() - 1);
+		break;
+	}
+
+	case 4:
+		historyDisplay(false, -(s32)h());
+		return;
+
+	case 5:
+		historyDisplay(false, -(s32)h() / 2);
+		return;
+
+	case 6:
+		historyDisplay(false, h());
+		return;
+
+	case 7: {
+		// random text and colors, every run the same
+		static const s8 * const pieces[] = {
+			"\r\n", "  ", "\e[0m", "\e[7m", "\e[1m", "中", "┼", "⣿", "é", "\e[A", "\e[2C", "\e[L", "\e[P",
+		};
+		u32 seed = 12345;
+
+		while (p < buf + sizeof(buf) - 32) {
+			seed = seed * 1103515245 + 12345;
+			u32 r = seed >> 16;
+
+			if (r % 4) *p++ = ' ' + r % 95;
+			else if (r % 3) p += sprintf(p, "\e[%u;%u}", 1 + r / 4 % 2, r / 8 % 256);
+			else p += sprintf(p, "%s", pieces[r / 16 % (sizeof(pieces) / sizeof(pieces[0]))]);
+		}
+		break;
+	}
+
+	default:
+		return;
+	}
+
+	input((const u8 *)buf, p - buf);
+}
+
+void RenderCheck::drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws)
+{
+	FbShell::adjustCharAttr(attr);
+	screen->drawText(FW(x), FH(y), attr.fcolor, attr.bcolor, num, chars, dws);
+}
+
+void RenderCheck::drawLine(u16 x, u16 y, u16 num, u16 *chars, bool *dws, CharAttr *attrs)
+{
+	// odd lines take the drawChars() path, even ones drawRow(), as FbShell draws them
+	if (y & 1) {
+		VTerm::drawLine(x, y, num, chars, dws, attrs);
+		return;
+	}
+
+	u32 line, generation;
+	bool history = historyLine(x, y, num, dws, line, generation);
+
+	if (history && screen->drawCachedRow(FH(y), line, generation)) return;
+
+	u8 fcs[num], bcs[num];
+	for (u16 i = 0; i < num; i++) {
+		CharAttr attr = attrs[i];
+		FbShell::adjustCharAttr(attr);
+
+		fcs[i] = attr.fcolor;
+		bcs[i] = attr.bcolor;
+	}
+
+	screen->drawRow(FW(x), FH(y), num, chars, dws, fcs, bcs);
+	if (history) screen->cacheRow(FH(y), line, generation);
+}
+
+bool RenderCheck::deferUpdate()
+{
+	return deferFrames;
+}
+
+bool RenderCheck::moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h)
+{
+	if (!screen->move(sx, sy, dx, dy, w, h)) return false;
+
+	// a pan moves the whole screen, Screen::move() has FbShellManager redraw the rest of it, which
+	// only knows of FbShell
+	u16 top = (sy < dy) ? sy : dy, bot = ((sy > dy) ? sy : dy) + h;
+	if (top) expose(0, 0, this->w(), top);
+	if (bot < this->h()) expose(0, bot, this->w(), this->h() - bot);
+	if (sx) expose(0, top, sx, bot - top - 1);
+	if (sx + w < this->w()) expose(sx + w, top, this->w() - sx - w, bot - top - 1);
+
+	return true;
+}
+
+void RenderCheck::drawCursor(CharAttr attr, u16 x, u16 y, u16 c)
+{
+	FbShell::adjustCharAttr(attr);
+
+	bool dw = (attr.type != CharAttr::Single);
+	if (attr.type == CharAttr::DoubleRight) x--;
+	screen->overlayText(0, FW(x), FH(y), attr.bcolor, attr.fcolor, c, dw);
+}
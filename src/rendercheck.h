@@ -0,0 +1,47 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef RENDERCHECK_H
+#define RENDERCHECK_H
+
+#include "vterm.h"
+
+// --render-check: draws a fixed corpus of terminal output on memory screens of every depth and
+// rotation, with and without a background image, once with the plain rendering path and then with
+// each faster one, and reports the frames which aren't the same byte for byte
+class RenderCheck : public VTerm {
+public:
+	// returns the exit status, 0 when every frame is the same, 1 when some frame differs and
+	// 77, which automake takes as a skipped test, when the font the corpus is drawn with is missing
+	static s32 run();
+
+private:
+	RenderCheck(u16 w, u16 h) : VTerm(w, h) {}
+
+	virtual void drawChars(CharAttr attr, u16 x, u16 y, u16 w, u16 num, u16 *chars, bool *dws);
+	virtual void drawLine(u16 x, u16 y, u16 num, u16 *chars, bool *dws, CharAttr *attrs);
+	virtual bool moveChars(u16 sx, u16 sy, u16 dx, u16 dy, u16 w, u16 h);
+	virtual void drawCursor(CharAttr attr, u16 x, u16 y, u16 c);
+	virtual bool deferUpdate();
+
+	void playStep(u32 step);
+	static s32 renderCorpus(u32 depth, u32 rotate, const s8 *name, const s8 * const *options, u8 *frames);
+};
+#endif
@@ -26,6 +26,8 @@
 #include "fbshellman.h"
 #include "fbconfig.h"
 #include "fbdev.h"
+#include "memdev.h"
+#include "colorcache.h"
 #include "config.h"
 #ifdef ENABLE_VESA
 #include "vesadev.h"
@@ -52,6 +54,13 @@ Screen *Screen::createInstance()
 
 	Screen *pScreen = 0;
 
+	s8 mem[32];
+	Config::instance()->getOption("mem-screen", mem, sizeof(mem));
+	if (*mem) {
+		pScreen = MemDev::initMemDev(mem);
+		if (!pScreen) return 0;
+	}
+
 #ifdef ENABLE_VESA
 	s8 buf[16];
 	Config::instance()->getOption("vesa-mode", buf, sizeof(buf));
@@ -63,10 +72,10 @@ Screen *Screen::createInstance()
 	u32 mode = 0;
 	Config::instance()->getOption("vesa-mode", mode);
 
-	if (!mode) pScreen = FbDev::initFbDev();
+	if (!pScreen && !mode) pScreen = FbDev::initFbDev();
 	if (!pScreen) pScreen = VesaDev::initVesaDev(mode);
 #else
-	pScreen = FbDev::initFbDev();
+	if (!pScreen) pScreen = FbDev::initFbDev();
 #endif
 
 	if (!pScreen) return 0;
@@ -87,6 +96,7 @@ Screen *Screen::createInstance()
 	}
 
 	pScreen->initFillDraw();
+	pScreen->initThreads();
 	return pScreen;
 }
 
@@ -95,6 +105,7 @@ Screen::Screen()
 	mWidth = mHeight = 0;
 	mCols = mRows = 0;
 	mBitsPerPixel = mBytesPerLine = 0;
+	memset(&mLayout, 0, sizeof(mLayout));
 
 	mScrollEnable = true;
 	mScrollType = Redraw;
@@ -103,20 +114,47 @@ Screen::Screen()
 
 	mVMemBase = 0;
 	mPalette = 0;
+	mDrawName = "scalar";
+	mCellW = mCellH = 0;
+	mPageLines = 0;
+	mFrontPage = 0;
+
+	mRenderBase = 0;
+	mRenderPitch = 0;
+	mShadowMem = 0;
+	mShadowEnable = false;
+	mVcActive = false;
+	mBatchRunning = false;
+	mClipNum = 0;
+	memset(mClipRects, 0, sizeof(mClipRects));
+	memset(mOverlays, 0, sizeof(mOverlays));
+	mOverlaysShown = 0;
+	Config::instance()->getOption("shadow-buffer", mShadowEnable);
 
 	u32 type = Rotate0;
 	Config::instance()->getOption("screen-rotate", type);
 	if (type > Rotate270) type = Rotate0;
 	mRotateType = (RotateType)type;
 
+	mRotateOnFlush = false;
+	if (mRotateType == Rotate90 || mRotateType == Rotate270) {
+		Config::instance()->getOption("rotate-on-flush", mRotateOnFlush);
+	}
+
 	s32 ret = write(STDIN_FILENO, hide_cursor, sizeof(hide_cursor) - 1);
 	ret = write(STDIN_FILENO, disable_blank, sizeof(disable_blank) - 1);
 }
 
 Screen::~Screen()
 {
+	endThreads();
 	Font::uninstance();
 	endFillDraw();
+	endShadow();
+
+	for (u32 i = 0; i < NR_OVERLAYS; i++) {
+		delete[] mOverlays[i].pixels;
+	}
 
 	s32 ret = write(STDIN_FILENO, show_cursor, sizeof(show_cursor) - 1);
 	ret = write(STDIN_FILENO, enable_blank, sizeof(enable_blank) - 1);
@@ -130,13 +168,39 @@ void Screen::showInfo(bool verbose)
 	static const s8* const scrollstr[4] = {
 		"redraw", "ypan", "ywrap", "xpan"
 	};
-	printf("[screen] driver: %s, mode: %dx%d-%dbpp, scrolling: %s\n",
-		drvId(), mWidth, mHeight, mBitsPerPixel, scrollstr[mScrollType]);
+	printf("[screen] driver: %s, mode: %dx%d-%dbpp, scrolling: %s, rendering: %s, shadow buffer: %s, render threads: %u%s\n",
+		drvId(), mWidth, mHeight, mBitsPerPixel, scrollstr[mScrollType], mDrawName,
+		mShadowMem ? (mPageLines ? "yes, page flipping" : "yes") : "no", renderThreads(),
+		mRotateOnFlush ? ", rotated on flush" : "");
+}
+
+void Screen::showStats(bool verbose)
+{
+	ColorCache::showStats(verbose);
+	BlendTables::showStats(verbose);
+	LineCache::showStats(verbose);
+
+	if (verbose && mWrapCount) {
+		printf("[screen] pan wraps: %u, %u us spent copying\n", mWrapCount, mWrapUsecs);
+	}
 }
 
 void Screen::switchVc(bool enter)
 {
+	drawQueued();
+	dropOverlays();
+
+	if (enter) {
+		initShadow();
+		selectPipeline();
+	} else {
+		flush();
+		resetShadowOffset();
+	}
+	mVcActive = enter;
+
 	mOffsetCur = 0;
+	mFrontPage = 0;
 	setupOffset();
 
 	setupPalette(!enter);
@@ -145,7 +209,13 @@ void Screen::switchVc(bool enter)
 
 bool Screen::move(u16 scol, u16 srow, u16 dcol, u16 drow, u16 w, u16 h)
 {
-	if (!mScrollEnable || mScrollType == Redraw || scol != dcol) return false;
+	if (!mScrollEnable) return false;
+	drawQueued();
+
+	// overlays stay where they are, the text under them is moved
+	for (u32 i = 0; i < NR_OVERLAYS; i++) {
+		hideOverlay(i);
+	}
 
 	u16 top = MIN(srow, drow), bot = MAX(srow, drow) + h;
 	u16 left = scol, right = scol + w;
@@ -153,19 +223,28 @@ bool Screen::move(u16 scol, u16 srow, u16 dcol, u16 drow, u16 w, u16 h)
 	u32 noaccel_redraw_area = w * (bot - top - 1);
 	u32 accel_redraw_area = mCols * mRows - w * h;
 
-	if (noaccel_redraw_area <= accel_redraw_area) return false;
+	if (mScrollType == Redraw || scol != dcol || noaccel_redraw_area <= accel_redraw_area) {
+		// reading video memory is slow, only the shadow buffer is worth copying around
+		if (!mShadowMem) return false;
 
-	if (mRotateType == Rotate0 || mRotateType == Rotate270) mOffsetCur += FH((s32)srow - drow);
-	else mOffsetCur -= FH((s32)srow - drow);
+		return copyRect(FW(scol), FH(srow), FW(dcol), FH(drow), FW(w), FH(h));
+	}
+
+	s32 delta = FH((s32)srow - drow);
+	if (mRotateType == Rotate90 || mRotateType == Rotate180) delta = -delta;
 
 	bool redraw_all = false;
 	if (mScrollType == YPan || mScrollType == XPan) {
-		redraw_all = true;
+		s32 offset = mOffsetCur + delta;
 
-		if (mOffsetCur < 0) mOffsetCur = mOffsetMax;
-		else if ((u32)mOffsetCur > mOffsetMax) mOffsetCur = 0;
-		else redraw_all = false;
+		if (offset >= 0 && (u32)offset <= mOffsetMax) {
+			mOffsetCur = offset;
+		} else if (!wrapOffset(delta)) {
+			redraw_all = true;
+			mOffsetCur = (offset < 0) ? mOffsetMax : 0;
+		}
 	} else {
+		mOffsetCur += delta;
 		if (mOffsetCur < 0) mOffsetCur += mOffsetMax + 1;
 		else if ((u32)mOffsetCur > mOffsetMax) mOffsetCur -= mOffsetMax + 1;
 	}
@@ -199,146 +278,101 @@ void Screen::eraseMargin(bool top, u16 h)
 
 void Screen::drawText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
 {
-	u32 startx, fw = FW(1);
-
-	u16 startnum, *starttext;
-	bool *startdw, draw_space = false, draw_text = false;
-
-	for (; num; num--, text++, dw++, x += fw) {
-		if (*text == 0x20) {
-			if (draw_text) {
-				draw_text = false;
-				drawGlyphs(startx, y, fc, bc, startnum - num, starttext, startdw);
-			}
-
-			if (!draw_space) {
-				draw_space = true;
-				startx = x;
-			}
-		} else {
-			if (draw_space) {
-				draw_space = false;
-				fillRect(startx, y, x - startx, FH(1), bc);
-			}
-
-			if (!draw_text) {
-				draw_text = true;
-				starttext = text;
-				startdw = dw;
-				startnum = num;
-				startx = x;
-			}
-
-			if (*dw) x += fw;
-		}
-	}
-
-	if (draw_text) {
-		drawGlyphs(startx, y, fc, bc, startnum - num, starttext, startdw);
-	} else if (draw_space) {
-		fillRect(startx, y, x - startx, FH(1), bc);
-	}
+	coverOverlays(x, y, num, dw);
+	if (!queueText(x, y, fc, bc, num, text, dw)) renderText(x, y, fc, bc, num, text, dw);
 }
 
-void Screen::drawGlyphs(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
+bool Screen::drawRow(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc)
 {
-	for (; num--; text++, dw++) {
-		drawGlyph(x, y, fc, bc, *text, *dw);
-		x += *dw ? FW(2) : FW(1);
+	if (!mClipNum) {
+		drawCells(x, y, num, text, dw, fc, bc);
+		return false;
 	}
-}
 
-void Screen::adjustOffset(u32 &x, u32 &y)
-{
-	if (mScrollType == XPan) x += mOffsetCur;
-	else y += mOffsetCur;
-}
+	bool overlap = false;
+	u16 start = 0;
+	u32 startx = x;
 
-void Screen::fillRect(u32 x, u32 y, u32 w, u32 h, u8 color)
-{
-	if (x >= mWidth || y >= mHeight || !w || !h) return;
-	if (x + w > mWidth) w = mWidth - x;
-	if (y + h > mHeight) h = mHeight - y;
+	for (u16 i = 0; i < num; i++) {
+		u32 w = dw[i] ? FW(2) : FW(1);
+		ClipState state = clipState(x, y, w, FH(1));
+		x += w;
 
-	rotateRect(x, y, w, h);
-	adjustOffset(x, y);
+		if (state == ClipPartial) overlap = true;
+		if (state != ClipHidden) continue;
 
-	for (; h--;) {
-		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
-		(this->*fill)(x, y++, w, color);
+		if (start < i) drawCells(startx, y, i - start, text + start, dw + start, fc + start, bc + start);
+		start = i + 1;
+		startx = x;
 	}
+
+	if (start < num) drawCells(startx, y, num - start, text + start, dw + start, fc + start, bc + start);
+	return overlap;
 }
 
-void Screen::drawGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw)
+void Screen::setClipRect(u32 id, u32 x, u32 y, u32 w, u32 h)
 {
-	if (x >= mWidth || y >= mHeight) return;
+	if (id >= NR_CLIP_RECTS) return;
 
-	s32 w = (dw ? FW(2) : FW(1)), h = FH(1);
-	if (x + w > mWidth) w = mWidth - x;
-	if (y + h > mHeight) h = mHeight - y;
+	if (!w || !h) w = h = 0;
+	ClipRect rect = { x, y, w, h };
+	mClipRects[id] = rect;
 
-	Font::Glyph *glyph = (Font::Glyph *)Font::instance()->getGlyph(code);
-	if (!glyph) {
-		fillRect(x, y, w, h, bc);
-		return;
+	mClipNum = 0;
+	for (u32 i = 0; i < NR_CLIP_RECTS; i++) {
+		if (mClipRects[i].w) mClipNum = i + 1;
 	}
+}
 
-	s32 top = glyph->top;
-	if (top < 0) top = 0;
-
-	s32 left = glyph->left;
-	if ((s32)x + left < 0) left = -x;
-
-	s32 width = glyph->width;
-	if (width > w - left) width = w - left;
-	if ((s32)x + left + width > (s32)mWidth) width = mWidth - ((s32)x + left);
-	if (width < 0) width = 0;
-
-	s32 height = glyph->height;
-	if (height > h - top) height = h - top;
-	if (y + top + height > mHeight) height = mHeight - (y + top);
-	if (height < 0) height = 0;
-
-	if (top) fillRect(x, y, w, top, bc);
-	if (left > 0) fillRect(x, y + top, left, height, bc);
+Screen::ClipState Screen::clipState(u32 x, u32 y, u32 w, u32 h)
+{
+	ClipState state = ClipNone;
 
-	s32 right = width + left;
-	if (w > right) fillRect((s32)x + right, y + top, w - right, height, bc);
+	for (u32 i = 0; i < mClipNum; i++) {
+		ClipRect &r = mClipRects[i];
+		if (!r.w || x >= r.x + r.w || y >= r.y + r.h || x + w <= r.x || y + h <= r.y) continue;
+		if (x >= r.x && y >= r.y && x + w <= r.x + r.w && y + h <= r.y + r.h) return ClipHidden;
+		state = ClipPartial;
+	}
 
-	s32 bot = top + height;
-	if (h > bot) fillRect(x, y + bot, w, h - bot, bc);
+	return state;
+}
 
-	x += left;
-	y += top;
-	if (x >= mWidth || y >= mHeight || !width || !height) return;
+void Screen::drawCells(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc)
+{
+	coverOverlays(x, y, num, dw);
 
-	u32 nwidth = width, nheight = height;
-	rotateRect(x, y, nwidth, nheight);
+	if (renderThreads() <= 1) {
+		(this->*mRenderRow)(x, y, num, text, dw, fc, bc);
+		return;
+	}
 
-	u8 *pixmap = glyph->pixmap;
-	u32 wdiff = glyph->width - width, hdiff = glyph->height - height;
+	// render threads are given one run of colors at a time
+	for (u16 start = 0, i = 1; i <= num; i++) {
+		if (i < num && fc[i] == fc[start] && bc[i] == bc[start]) continue;
 
-	if (wdiff) {
-		if (mRotateType == Rotate180) pixmap += wdiff;
-		else if (mRotateType == Rotate270) pixmap += wdiff * glyph->pitch;
+		drawText(x, y, fc[start], bc[start], i - start, text + start, dw + start);
+		for (; start < i; start++) x += dw[start] ? FW(2) : FW(1);
 	}
+}
 
-	if (hdiff) {
-		if (mRotateType == Rotate90) pixmap += hdiff;
-		else if (mRotateType == Rotate180) pixmap += hdiff * glyph->pitch;
-	}
+void Screen::adjustOffset(u32 &x, u32 &y)
+{
+	if (mScrollType == XPan) x += mOffsetCur;
+	else y += mOffsetCur;
+}
 
-	adjustOffset(x, y);
-	for (; nheight--; y++, pixmap += glyph->pitch) {
-		if ((mScrollType == YWrap) && y > mOffsetMax) y -= mOffsetMax + 1;
-		(this->*draw)(x, y, nwidth, fc, bc, pixmap);
-	}
+void Screen::fillRect(u32 x, u32 y, u32 w, u32 h, u8 color)
+{
+	drawQueued();
+	coverOverlays(x, y, w, h);
+	(this->*mFillRect)(x, y, w, h, color);
 }
 
 void Screen::rotateRect(u32 &x, u32 &y, u32 &w, u32 &h)
 {
 	u32 tmp;
-	switch (mRotateType) {
+	switch (renderRotate()) {
 	case Rotate0:
 		break;
 
@@ -372,7 +406,7 @@ void Screen::rotateRect(u32 &x, u32 &y, u32 &w, u32 &h)
 void Screen::rotatePoint(u32 W, u32 H, u32 &x, u32 &y)
 {
 	u32 tmp;
-	switch (mRotateType) {
+	switch (renderRotate()) {
 	case Rotate0:
 		break;
 
@@ -25,11 +25,22 @@
 #include "instance.h"
 
 #define NR_COLORS 256
+#define NR_CLIP_RECTS 16
+#define NR_OVERLAYS 2
 
 struct Color {
 	u8 red, green, blue;
 };
 
+// where a color component lies in a pixel, as fb_var_screeninfo describes it
+struct ColorField {
+	u8 offset, length;
+};
+
+struct PixelLayout {
+	ColorField red, green, blue;
+};
+
 typedef enum { Rotate0 = 0, Rotate90, Rotate180, Rotate270 } RotateType;
 
 class Screen
@@ -42,24 +53,48 @@ public :
 	u16 rows() { return mRows; }
 
 	RotateType rotateType() { return mRotateType; }
+	// the rotation text is drawn with, none when the screen is rotated on flush
+	RotateType renderRotate() { return mRotateOnFlush ? Rotate0 : mRotateType; }
 	void rotateRect(u32 &x, u32 &y, u32 &w, u32 &h);
 	void rotatePoint(u32 w, u32 h, u32 &x, u32 &y);
 
 	void drawText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
+	// a row of cells with colors of their own, fc and bc have one entry for each of text,
+	// returns true when some of the cells drawn overlap a clip rectangle
+	bool drawRow(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc);
+	// cells hidden under a clip rectangle are left out of drawRow(), a rectangle of zero size is removed
+	void setClipRect(u32 id, u32 x, u32 y, u32 w, u32 h);
+
+	// overlays, such as the cursor, save the pixels under them before being drawn, and hideOverlay()
+	// puts those back. anything else drawn over an overlay hides it first
+	void overlayText(u32 id, u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw);
+	void overlayRect(u32 id, u32 x, u32 y, u32 w, u32 h, u8 color);
+	void hideOverlay(u32 id);
 	void fillRect(u32 x, u32 y, u32 w, u32 h, u8 color);
 
+	// with history-cache-size set, rows of history text across the whole screen width are kept
+	// after being drawn, drawCachedRow() puts one back and returns false when it isn't there
+	bool drawCachedRow(u32 y, u32 line, u32 generation);
+	void cacheRow(u32 y, u32 line, u32 generation);
+
 	bool move(u16 scol, u16 srow, u16 dcol, u16 drow, u16 w, u16 h);
 	void setPalette(const Color *palette);
 	
 	void enableScroll(bool enable) { mScrollEnable = enable; }
 
 	void showInfo(bool verbose);
+	static void showStats(bool verbose);
 	virtual void switchVc(bool enter);
 
+	void flush();
+	bool restoreFromShadow();
+
 protected:
 	u32 mWidth, mHeight;
 	u16 mCols, mRows;
 	u32 mBitsPerPixel, mBytesPerLine;
+	// drivers may leave it zero for the usual rgb order of mBitsPerPixel
+	PixelLayout mLayout;
 
 	RotateType mRotateType;
 
@@ -71,35 +106,126 @@ protected:
 	u8 *mVMemBase;
 	const Color *mPalette;
 
+	// page flipping: shadow buffer is copied to the hidden one of two pages of mPageLines lines,
+	// which then becomes mFrontPage
+	u32 mPageLines, mFrontPage;
+
 private:
 	virtual void setupOffset() {}
 	virtual void setupPalette(bool restore) {}
 	virtual const s8 *drvId() = 0;
 
 	void eraseMargin(bool top, u16 h);
-	void drawGlyphs(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
-	void drawGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw);
+	void drawCells(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc);
+
+	typedef enum { ClipNone = 0, ClipPartial, ClipHidden } ClipState;
+	ClipState clipState(u32 x, u32 y, u32 w, u32 h);
+
+	bool saveUnder(u32 id, u32 x, u32 y, u32 w, u32 h, u16 code, u8 fc, u8 bc);
+	void coverOverlays(u32 x, u32 y, u32 w, u32 h);
+	void coverOverlays(u32 skip, u32 x, u32 y, u32 w, u32 h);
+	void coverOverlays(u32 x, u32 y, u16 num, bool *dw);
+	void dropOverlays();
+	bool cachedRowRect(u32 y, u32 &x, u32 &w, u32 &h);
+	void renderText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw) {
+		(this->*mRenderText)(x, y, fc, bc, num, text, dw);
+	}
 	void adjustOffset(u32 &x, u32 &y);
 
+	// the render pipeline, instantiated for every pixel format, rotation, scroll type and
+	// background image mode in screen_render.cpp
+	template <class P> void renderText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
+	template <class P> void renderRow(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc);
+	template <class P> void drawGlyphs(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
+	template <class P> void drawGlyphsBg(u32 x, u32 y, u8 fc, u16 num, u16 *text, bool *dw);
+	template <class P> void drawGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw);
+	template <class P> bool drawCachedGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw);
+	template <class P> u8 *cachedCell(u8 fc, u8 bc, u16 code, bool dw);
+	template <class P> void fillRect(u32 x, u32 y, u32 w, u32 h, u8 color);
+	template <class P> void adjustOffset(u32 &x, u32 &y);
+	template <class P> void fillSpan(u32 x, u32 y, u32 w, u8 color);
+	template <class P> void fillWide(u32 x, u32 y, u32 w, u32 h, u8 color);
+	template <class P> void drawSpan(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap, const u32 *table);
+	template <u32 bits> void selectRotate(RotateType rotate, bool bg);
+	template <u32 bits, RotateType rotate> void selectScroll(bool bg);
+
+	const u32 *blendTable(u8 fc, u8 bc);
+
 	void initFillDraw();
 	void endFillDraw();
-
-	void fillX(u32 x, u32 y, u32 w, u8 color);
-	void fillXBg(u32 x, u32 y, u32 w, u8 color);
-	void draw8(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw15(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw16(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw32(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw8Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw15Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw16Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-	void draw32Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-
-	typedef void (Screen::*fillFun)(u32 x, u32 y, u32 w, u8 color);
-	typedef void (Screen::*drawFun)(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap);
-
-	fillFun fill;
-	drawFun draw;
+	void selectPipeline();
+
+	u32 videoLines();
+	void initShadow();
+	void endShadow();
+	void resetShadowOffset();
+	void mergePrevDamage();
+	void flushRotated(u8 *vmem);
+	void damageRect(u32 x, u32 y, u32 w, u32 h);
+	bool copyRect(u32 sx, u32 sy, u32 dx, u32 dy, u32 w, u32 h);
+	bool wrapOffset(s32 delta);
+	void damage(u32 x, u32 y, u32 w) {
+		// render threads leave it to queueText()
+		if (!mShadowMem || mBatchRunning) return;
+		if (x < mDamageLeft[y]) mDamageLeft[y] = x;
+		if (x + w > mDamageRight[y]) mDamageRight[y] = x + w;
+		if (y < mDamageTop) mDamageTop = y;
+		if (y >= mDamageBot) mDamageBot = y + 1;
+	}
+
+	void initThreads();
+	void endThreads();
+	u32 renderThreads();
+	bool queueText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
+	void drawQueued();
+	void renderBand(u32 band);
+	static void *renderThread(void *arg);
+
+	typedef void (Screen::*textFun)(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw);
+	typedef void (Screen::*rectFun)(u32 x, u32 y, u32 w, u32 h, u8 color);
+	typedef void (Screen::*rowFun)(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc);
+
+	textFun mRenderText;
+	rowFun mRenderRow;
+	rectFun mFillRect;
+	u32 mCellW, mCellH;
+	const s8 *mDrawName;
 	bool mScrollEnable;
+
+	// drawing goes to mRenderBase, which is mShadowMem in shadow buffer mode or mVMemBase otherwise
+	u8 *mRenderBase;
+	u32 mRenderPitch;
+	// screen is drawn unrotated into shadow buffer, flush() rotates it to video memory
+	bool mRotateOnFlush;
+	u8 *mShadowMem;
+	bool mShadowEnable, mVcActive;
+	u32 *mDamageLeft, *mDamageRight;
+	u32 mDamageTop, mDamageBot;
+	// damage of the last flip, the hidden page misses it too
+	u32 *mPrevDamageLeft, *mPrevDamageRight;
+	u32 mPrevDamageTop, mPrevDamageBot;
+
+	// the input method windows, which drawRow() keeps terminal text out of
+	struct ClipRect {
+		u32 x, y, w, h;
+	} mClipRects[NR_CLIP_RECTS];
+	u32 mClipNum;
+
+	struct Overlay {
+		u32 x, y, w, h;
+		// what has been drawn, an overlay drawn again unchanged is left alone
+		u16 code;
+		u8 fc, bc;
+		bool shown;
+		u8 *pixels;
+		u32 size;
+	} mOverlays[NR_OVERLAYS];
+	u32 mOverlaysShown;
+
+	// drawText() calls are being drawn by the render threads, see screen_thread.cpp
+	bool mBatchRunning;
+
+	// pans which ran past the end of video memory and the time spent copying the window back
+	static u32 mWrapCount, mWrapUsecs;
 };
 #endif
@@ -20,23 +20,52 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "config.h"
 #include "screen.h"
+#include "screen_simd.h"
+#include "colorcache.h"
+#include "font.h"
 #include "fbconfig.h"
 
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
 #define writeb(addr, val) (*(volatile u8 *)(addr) = (val))
 #define writew(addr, val) (*(volatile u16 *)(addr) = (val))
 #define writel(addr, val) (*(volatile u32 *)(addr) = (val))
 
 static u32 bytes_per_pixel;
-static u32 ppl, ppw, ppb;
 static u32 fillColors[NR_COLORS];
+static PixelLayout layout;
+// the palette as the kernels see it, they always draw the usual rgb order
+static Color kernelColors[NR_COLORS];
+static bool swapRedBlue;
 
 static u8 *bgimage_mem;
 static u8 bgcolor;
 
+static SimdKernels kernels;
+static bool simdKernels;
+static TransposeFun transpose;
+static FillFun fill;
+static u32 streamSize;
+
+static ColorCache *colorCache;
+static BlendTables *blendTables;
+static LineCache *lineCache;
+static u8 *cellAlpha;
+
+static inline u32 packColor(u8 red, u8 green, u8 blue)
+{
+	return packField(red, layout.red) | packField(green, layout.green) | packField(blue, layout.blue);
+}
+
 void Screen::setPalette(const Color *palette)
 {
 	if (mPalette == palette) return;
+	drawQueued();
 	mPalette = palette;
 
 	for (u32 i = 0; i < NR_COLORS; i++) {
@@ -45,61 +74,133 @@ void Screen::setPalette(const Color *palette)
 			fillColors[i] = (i << 24) | (i << 16) | (i << 8) | i;
 			break;
 		case 15:
-			fillColors[i] = ((palette[i].red >> 3) << 10) | ((palette[i].green >> 3) << 5) | (palette[i].blue >> 3);
-			fillColors[i] |= fillColors[i] << 16;
-			break;
 		case 16:
-			fillColors[i] = ((palette[i].red >> 3) << 11) | ((palette[i].green >> 2) << 5) | (palette[i].blue >> 3);
+			fillColors[i] = packColor(palette[i].red, palette[i].green, palette[i].blue);
 			fillColors[i] |= fillColors[i] << 16;
 			break;
-		case 32:
-			fillColors[i] = (palette[i].red << 16) | (palette[i].green << 8) | palette[i].blue;
+		default:
+			fillColors[i] = packColor(palette[i].red, palette[i].green, palette[i].blue);
 			break;
 		}
+
+		kernelColors[i] = palette[i];
+		if (swapRedBlue) {
+			kernelColors[i].red = palette[i].blue;
+			kernelColors[i].blue = palette[i].red;
+		}
 	}
 
+	if (colorCache) colorCache->flush();
+	if (blendTables) blendTables->flush();
+	if (lineCache) lineCache->flush();
+
 	setupPalette(false);
 	eraseMargin(true, mRows);
 }
 
 void Screen::initFillDraw()
 {
+	// a 16 bpp mode with 5 bits of green is drawn as 15 bpp
+	if (!mLayout.red.length) defaultLayout(mBitsPerPixel, mLayout);
+	if (mBitsPerPixel == 16 && mLayout.green.length == 5) mBitsPerPixel = 15;
+
+	layout = mLayout;
+	swapRedBlue = (layoutType(mBitsPerPixel, layout) == LayoutBgr);
+
 	if (mBitsPerPixel == 15) bytes_per_pixel = 2;
 	else bytes_per_pixel = (mBitsPerPixel >> 3);
 
-	ppl = 4 / bytes_per_pixel;
-	ppw = ppl >> 1;
-	ppb = ppl >> 2;
+	mCellW = FW(1);
+	mCellH = FH(1);
 
-	bool bg = false;
-	if (getenv("FBTERM_BACKGROUND_IMAGE")) {
-		bg = true;
-		mScrollType = Redraw;
+	SimdType simd = detectSimd();
+#ifdef FORCE_SIMD
+	// never pick a kernel the cpu can't run
+	if (FORCE_SIMD < simd) simd = FORCE_SIMD;
+#endif
+
+	s8 limit[8];
+	Config::instance()->getOption("render-simd", limit, sizeof(limit));
+	if (!strcmp(limit, "no")) simd = SimdNone;
+	else if (!strcmp(limit, "sse2") && simd > SimdSse2) simd = SimdSse2;
 
+	transpose = getTransposeKernel(simd, mBitsPerPixel);
+	fill = getFillKernel(simd, mBitsPerPixel);
+
+	// fills larger than the last level cache bypass it
+	long cache = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (cache <= 0) cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+	streamSize = (cache > 0) ? cache : (1 << 20);
+	initShadow();
+
+	if (getenv("FBTERM_BACKGROUND_IMAGE")) {
 		u32 color = 0;
 		Config::instance()->getOption("color-background", color);
 		if (color > 7) color = 0;
 		bgcolor = color;
 
-		u32 size = mBytesPerLine * ((mRotateType == Rotate0 || mRotateType == Rotate180) ? mHeight : mWidth);
+		u32 size = mRenderPitch * ((renderRotate() == Rotate0 || renderRotate() == Rotate180) ? mHeight : mWidth);
 		bgimage_mem = new u8[size];
-		memcpy(bgimage_mem, mVMemBase, size);
+		memcpy(bgimage_mem, mRenderBase, size);
+	}
+
+	bool kernelsOk = getSimdKernels(simd, mBitsPerPixel, layout, kernels);
+	if (kernelsOk && simd != SimdNone) {
+		simdKernels = true;
+		mDrawName = simdName(simd);
+	} else if (!kernelsOk) {
+		kernelsOk = getSimdKernels(SimdNone, mBitsPerPixel, layout, kernels);
+	}
+
+	selectPipeline();
+	blendTables = new BlendTables();
+
+	// rows drawn over the background image depend on where they are
+	u32 rowsSize = 0;
+	Config::instance()->getOption("history-cache-size", rowsSize);
+
+	if (rowsSize && !bgimage_mem) {
+		lineCache = new LineCache(rowsSize * 1024, FW(mCols) * FH(1) * bytes_per_pixel);
+		if (!lineCache->rows()) {
+			delete lineCache;
+			lineCache = 0;
+		}
 	}
 
-	fill = bg ? &Screen::fillXBg : &Screen::fillX;
+	if (!kernelsOk) return;
+
+	u32 size = 2048;
+	Config::instance()->getOption("color-cache-size", size);
+
+	if (size) {
+		colorCache = new ColorCache(size * 1024);
+		cellAlpha = new u8[FW(2) * FH(1)];
+	}
+}
+
+void Screen::selectPipeline()
+{
+	// the background image and rotation in flush() both need every change drawn into the buffer
+	if (bgimage_mem || mRotateOnFlush) mScrollType = Redraw;
 
 	switch (mBitsPerPixel) {
 	case 8:
-		draw = bg ? &Screen::draw8Bg : &Screen::draw8;
+		selectRotate<8>(renderRotate(), bgimage_mem);
 		break;
 	case 15:
-		draw = bg ? &Screen::draw15Bg : &Screen::draw15;
+		selectRotate<15>(renderRotate(), bgimage_mem);
 		break;
 	case 16:
-		draw = bg ? &Screen::draw16Bg : &Screen::draw16;
+		selectRotate<16>(renderRotate(), bgimage_mem);
+		break;
+	case 24:
+		selectRotate<24>(renderRotate(), bgimage_mem);
 		break;
 	case 32:
-		draw = bg ? &Screen::draw32Bg : &Screen::draw32;
+		selectRotate<32>(renderRotate(), bgimage_mem);
 		break;
 	}
 }
@@ -107,12 +208,621 @@ void Screen::initFillDraw()
 void Screen::endFillDraw()
 {
 	if (bgimage_mem) delete[] bgimage_mem;
+	if (colorCache) delete colorCache;
+	if (blendTables) delete blendTables;
+	if (lineCache) delete lineCache;
+	if (cellAlpha) delete[] cellAlpha;
+
+	// --render-check sets up screens one after another
+	bgimage_mem = 0;
+	colorCache = 0;
+	blendTables = 0;
+	lineCache = 0;
+	cellAlpha = 0;
+	simdKernels = false;
+}
+
+u32 Screen::videoLines()
+{
+	u32 lines = (renderRotate() == Rotate0 || renderRotate() == Rotate180) ? mHeight : mWidth;
+
+	if (mScrollType == YPan) lines += mOffsetMax;
+	else if (mScrollType == YWrap) lines = mOffsetMax + 1;
+
+	return lines;
+}
+
+void Screen::initShadow()
+{
+	// VesaDev maps video memory and sets mBytesPerLine on first entering the VT
+	mRenderPitch = mRotateOnFlush ? mWidth * bytes_per_pixel : mBytesPerLine;
+
+	if ((mShadowEnable || mPageLines || mRotateOnFlush) && !mShadowMem && mVMemBase) {
+		u32 lines = videoLines();
+
+		mShadowMem = new u8[lines * mRenderPitch];
+
+		if (!mRotateOnFlush) {
+			memcpy(mShadowMem, mVMemBase, lines * mBytesPerLine);
+		} else if (mRotateType == Rotate90) {
+			// line y of video memory holds column y of screen, bottom up
+			transpose(mShadowMem + (mHeight - 1) * mRenderPitch, -(s32)mRenderPitch, mVMemBase, mBytesPerLine, mHeight, mWidth);
+		} else {
+			// line y of video memory holds column mWidth - 1 - y of screen, top down
+			transpose(mShadowMem, mRenderPitch, mVMemBase + (mWidth - 1) * mBytesPerLine, -(s32)mBytesPerLine, mHeight, mWidth);
+		}
+
+		mDamageLeft = new u32[lines];
+		mDamageRight = new u32[lines];
+		for (u32 i = 0; i < lines; i++) {
+			mDamageLeft[i] = (u32)-1;
+			mDamageRight[i] = 0;
+		}
+
+		mDamageTop = lines;
+		mDamageBot = 0;
+
+		if (mPageLines) {
+			mPrevDamageLeft = new u32[lines];
+			mPrevDamageRight = new u32[lines];
+			memcpy(mPrevDamageLeft, mDamageLeft, lines * sizeof(u32));
+			memcpy(mPrevDamageRight, mDamageRight, lines * sizeof(u32));
+
+			mPrevDamageTop = lines;
+			mPrevDamageBot = 0;
+		}
+	}
+
+	mRenderBase = mShadowMem ? mShadowMem : mVMemBase;
+}
+
+void Screen::endShadow()
+{
+	if (!mShadowMem) return;
+
+	delete[] mShadowMem;
+	delete[] mDamageLeft;
+	delete[] mDamageRight;
+
+	if (mPageLines) {
+		delete[] mPrevDamageLeft;
+		delete[] mPrevDamageRight;
+	}
+}
+
+void Screen::resetShadowOffset()
+{
+	if (!mShadowMem || !mOffsetCur) return;
+
+	// video memory is shown from offset 0 again after switching back to this VT,
+	// so move the visible window of shadow buffer there
+	u32 lines = (renderRotate() == Rotate0 || renderRotate() == Rotate180) ? mHeight : mWidth;
+	u32 size = lines * mRenderPitch;
+	u8 *buf = new u8[size];
+
+	for (u32 i = 0; i < lines; i++) {
+		u32 x = 0, y = i;
+		if (mScrollType == XPan) {
+			x = mOffsetCur * bytes_per_pixel;
+		} else {
+			y += mOffsetCur;
+			if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		}
+
+		memcpy(buf + i * mRenderPitch, mShadowMem + y * mRenderPitch + x, mRenderPitch - x);
+	}
+
+	memcpy(mShadowMem, buf, size);
+	delete[] buf;
+}
+
+bool Screen::restoreFromShadow()
+{
+	drawQueued();
+	if (!mShadowMem) return false;
+
+	u32 lines = (renderRotate() == Rotate0 || renderRotate() == Rotate180) ? mHeight : mWidth;
+	for (u32 i = 0; i < lines; i++) {
+		damage(0, i, mRenderPitch / bytes_per_pixel);
+	}
+
+	return true;
+}
+
+#define ALIGN_DOWN(val) ((val) & ~63)
+#define ALIGN_UP(val) (((val) + 63) & ~63)
+
+void Screen::flush()
+{
+	drawQueued();
+	Font::instance()->endFrame();
+	if (!mShadowMem || !mVcActive || mDamageTop >= mDamageBot) return;
+
+	u8 *vmem = mVMemBase;
+	if (mPageLines) {
+		vmem += (mFrontPage ^ 1) * mPageLines * mBytesPerLine;
+		mergePrevDamage();
+	}
+
+	if (mRotateOnFlush) flushRotated(vmem);
+	else for (u32 y = mDamageTop; y < mDamageBot; y++) {
+		if (mDamageLeft[y] >= mDamageRight[y]) continue;
+
+		// widen dirty span to cache line boundaries, video memory likes long aligned bursts
+		u32 start = ALIGN_DOWN(mDamageLeft[y] * bytes_per_pixel);
+		u32 end = ALIGN_UP(mDamageRight[y] * bytes_per_pixel);
+		if (end > mBytesPerLine) end = mBytesPerLine;
+
+		u32 lines = 1;
+		if (!start && end == mBytesPerLine) {
+			// following whole lines are contiguous in memory, copy them together
+			for (; y + lines < mDamageBot; lines++) {
+				u32 next = y + lines;
+				if (mDamageLeft[next] >= mDamageRight[next] || ALIGN_DOWN(mDamageLeft[next] * bytes_per_pixel)
+					|| ALIGN_UP(mDamageRight[next] * bytes_per_pixel) < mBytesPerLine) break;
+
+				mDamageLeft[next] = (u32)-1;
+				mDamageRight[next] = 0;
+			}
+		}
+
+		u32 offset = y * mBytesPerLine + start;
+		memcpy(vmem + offset, mShadowMem + offset, (lines - 1) * mBytesPerLine + end - start);
+
+		mDamageLeft[y] = (u32)-1;
+		mDamageRight[y] = 0;
+		y += lines - 1;
+	}
+
+	mDamageTop = videoLines();
+	mDamageBot = 0;
+
+	if (mPageLines) {
+		mFrontPage ^= 1;
+		setupOffset();
+	}
+}
+
+void Screen::flushRotated(u8 *vmem)
+{
+	// rotate a band of lines at a time, as many as pixels fit in a cache line, so that each write
+	// to video memory fills whole cache lines and the band being read stays in cache
+	u32 band = 64 / bytes_per_pixel;
+
+	for (u32 top = mDamageTop / band * band; top < mDamageBot; top += band) {
+		u32 bot = MIN(top + band, mHeight), left = (u32)-1, right = 0;
+
+		for (u32 y = top; y < bot; y++) {
+			if (mDamageLeft[y] < left) left = mDamageLeft[y];
+			if (mDamageRight[y] > right) right = mDamageRight[y];
+
+			mDamageLeft[y] = (u32)-1;
+			mDamageRight[y] = 0;
+		}
+
+		if (left >= right) continue;
+
+		u8 *src = mShadowMem + top * mRenderPitch + left * bytes_per_pixel;
+		if (mRotateType == Rotate90) {
+			// pixel (x, y) goes to line x, column mHeight - 1 - y of video memory
+			transpose(vmem + left * mBytesPerLine + (mHeight - bot) * bytes_per_pixel, mBytesPerLine,
+				src + (bot - top - 1) * mRenderPitch, -(s32)mRenderPitch, right - left, bot - top);
+		} else {
+			// pixel (x, y) goes to line mWidth - 1 - x, column y of video memory
+			transpose(vmem + (mWidth - 1 - left) * mBytesPerLine + top * bytes_per_pixel, -(s32)mBytesPerLine,
+				src, mRenderPitch, right - left, bot - top);
+		}
+	}
+}
+
+void Screen::mergePrevDamage()
+{
+	// the hidden page was last updated two flushes ago, so it needs the damage of both flushes,
+	// while only this one's is kept for next time
+	for (u32 y = MIN(mDamageTop, mPrevDamageTop); y < MAX(mDamageBot, mPrevDamageBot); y++) {
+		u32 left = mDamageLeft[y], right = mDamageRight[y];
+
+		if (mPrevDamageLeft[y] < mDamageLeft[y]) mDamageLeft[y] = mPrevDamageLeft[y];
+		if (mPrevDamageRight[y] > mDamageRight[y]) mDamageRight[y] = mPrevDamageRight[y];
+
+		mPrevDamageLeft[y] = left;
+		mPrevDamageRight[y] = right;
+	}
+
+	u32 top = mDamageTop, bot = mDamageBot;
+	mDamageTop = MIN(mDamageTop, mPrevDamageTop);
+	mDamageBot = MAX(mDamageBot, mPrevDamageBot);
+	mPrevDamageTop = top;
+	mPrevDamageBot = bot;
+}
+
+void Screen::damageRect(u32 x, u32 y, u32 w, u32 h)
+{
+	if (!mShadowMem || x >= mWidth || y >= mHeight || !w || !h) return;
+	if (x + w > mWidth) w = mWidth - x;
+	if (y + h > mHeight) h = mHeight - y;
+
+	rotateRect(x, y, w, h);
+	adjustOffset(x, y);
+
+	for (; h--; y++) {
+		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		damage(x, y, w);
+	}
+}
+
+bool Screen::copyRect(u32 sx, u32 sy, u32 dx, u32 dy, u32 w, u32 h)
+{
+	// the background image stays where it is, only the text over it can move
+	if (bgimage_mem) return false;
+
+	u32 sw = w, sh = h;
+	rotateRect(sx, sy, sw, sh);
+	adjustOffset(sx, sy);
+	rotateRect(dx, dy, w, h);
+	adjustOffset(dx, dy);
+
+	// lines overlapping between source and destination are copied before being overwritten
+	u32 size = w * bytes_per_pixel;
+	for (u32 i = 0; i < h; i++) {
+		u32 n = (dy > sy) ? h - 1 - i : i;
+		u32 ys = sy + n, yd = dy + n;
+
+		if (mScrollType == YWrap) {
+			if (ys > mOffsetMax) ys -= mOffsetMax + 1;
+			if (yd > mOffsetMax) yd -= mOffsetMax + 1;
+		}
+
+		memmove(mRenderBase + yd * mRenderPitch + dx * bytes_per_pixel, mRenderBase + ys * mRenderPitch + sx * bytes_per_pixel, size);
+		damage(dx, yd, w);
+	}
+
+	return true;
+}
+
+bool Screen::saveUnder(u32 id, u32 x, u32 y, u32 w, u32 h, u16 code, u8 fc, u8 bc)
+{
+	if (x >= mWidth || y >= mHeight || !w || !h) {
+		hideOverlay(id);
+		return false;
+	}
+
+	if (x + w > mWidth) w = mWidth - x;
+	if (y + h > mHeight) h = mHeight - y;
+
+	Overlay &overlay = mOverlays[id];
+	if (overlay.shown && overlay.x == x && overlay.y == y && overlay.w == w && overlay.h == h
+		&& overlay.code == code && overlay.fc == fc && overlay.bc == bc) return false;
+
+	hideOverlay(id);
+	u32 size = w * h * bytes_per_pixel;
+
+	if (size > overlay.size) {
+		delete[] overlay.pixels;
+		overlay.pixels = new u8[size];
+		overlay.size = size;
+	}
+
+	overlay.x = x, overlay.y = y, overlay.w = w, overlay.h = h;
+	overlay.code = code, overlay.fc = fc, overlay.bc = bc;
+	overlay.shown = true;
+	mOverlaysShown++;
+
+	rotateRect(x, y, w, h);
+	adjustOffset(x, y);
+
+	u32 pitch = w * bytes_per_pixel;
+	u8 *pixels = overlay.pixels;
+	for (; h--; y++, pixels += pitch) {
+		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		memcpy(pixels, mRenderBase + y * mRenderPitch + x * bytes_per_pixel, pitch);
+	}
+
+	return true;
+}
+
+void Screen::hideOverlay(u32 id)
+{
+	if (id >= NR_OVERLAYS || !mOverlays[id].shown) return;
+	drawQueued();
+
+	Overlay &overlay = mOverlays[id];
+	overlay.shown = false;
+	mOverlaysShown--;
+
+	u32 x = overlay.x, y = overlay.y, w = overlay.w, h = overlay.h;
+	rotateRect(x, y, w, h);
+	adjustOffset(x, y);
+
+	u32 pitch = w * bytes_per_pixel;
+	u8 *pixels = overlay.pixels;
+	for (; h--; y++, pixels += pitch) {
+		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		memcpy(mRenderBase + y * mRenderPitch + x * bytes_per_pixel, pixels, pitch);
+		damage(x, y, w);
+	}
+}
+
+void Screen::overlayText(u32 id, u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw)
+{
+	if (id >= NR_OVERLAYS) return;
+
+	// the windows of clip rectangles are drawn over the text by someone else, overlays included
+	u32 w = dw ? FW(2) : FW(1), h = FH(1);
+	if (clipState(x, y, w, h) != ClipNone) {
+		hideOverlay(id);
+		return;
+	}
+
+	coverOverlays(id, x, y, w, h);
+	drawQueued();
+	if (saveUnder(id, x, y, w, h, code, fc, bc)) renderText(x, y, fc, bc, 1, &code, &dw);
+}
+
+void Screen::overlayRect(u32 id, u32 x, u32 y, u32 w, u32 h, u8 color)
+{
+	if (id >= NR_OVERLAYS) return;
+
+	if (clipState(x, y, w, h) != ClipNone) {
+		hideOverlay(id);
+		return;
+	}
+
+	coverOverlays(id, x, y, w, h);
+	drawQueued();
+	if (saveUnder(id, x, y, w, h, 0, color, color)) (this->*mFillRect)(x, y, w, h, color);
+}
+
+void Screen::coverOverlays(u32 x, u32 y, u32 w, u32 h)
+{
+	coverOverlays(NR_OVERLAYS, x, y, w, h);
+}
+
+void Screen::coverOverlays(u32 skip, u32 x, u32 y, u32 w, u32 h)
+{
+	if (!mOverlaysShown) return;
+
+	for (u32 i = 0; i < NR_OVERLAYS; i++) {
+		Overlay &o = mOverlays[i];
+		if (i == skip || !o.shown || x >= o.x + o.w || y >= o.y + o.h || x + w <= o.x || y + h <= o.y) continue;
+
+		hideOverlay(i);
+	}
+}
+
+void Screen::coverOverlays(u32 x, u32 y, u16 num, bool *dw)
+{
+	if (!mOverlaysShown) return;
+
+	u32 w = 0;
+	for (u16 i = 0; i < num; i++) {
+		w += dw[i] ? FW(2) : FW(1);
+	}
+
+	coverOverlays(x, y, w, FH(1));
+}
+
+void Screen::dropOverlays()
+{
+	for (u32 i = 0; i < NR_OVERLAYS; i++) {
+		mOverlays[i].shown = false;
+	}
+
+	mOverlaysShown = 0;
+}
+
+bool Screen::cachedRowRect(u32 y, u32 &x, u32 &w, u32 &h)
+{
+	// video memory is too slow to read rows back from
+	if (!lineCache || !mShadowMem) return false;
+
+	x = 0, w = FW(mCols), h = FH(1);
+	return y + h <= mHeight && clipState(x, y, w, h) == ClipNone;
+}
+
+bool Screen::drawCachedRow(u32 y, u32 line, u32 generation)
+{
+	u32 x, w, h;
+	if (!cachedRowRect(y, x, w, h)) return false;
+
+	u8 *pixels = lineCache->find(line, generation);
+	if (!pixels) return false;
+
+	drawQueued();
+	coverOverlays(x, y, w, h);
+
+	rotateRect(x, y, w, h);
+	adjustOffset(x, y);
+
+	u32 pitch = w * bytes_per_pixel;
+	for (; h--; y++, pixels += pitch) {
+		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		memcpy(mRenderBase + y * mRenderPitch + x * bytes_per_pixel, pixels, pitch);
+		damage(x, y, w);
+	}
+
+	return true;
+}
+
+void Screen::cacheRow(u32 y, u32 line, u32 generation)
+{
+	u32 x, w, h;
+	if (!cachedRowRect(y, x, w, h)) return;
+
+	// only the text itself is kept, not the overlays drawn over it
+	for (u32 i = 0; i < NR_OVERLAYS; i++) {
+		Overlay &overlay = mOverlays[i];
+		if (overlay.shown && overlay.y < y + h && overlay.y + overlay.h > y) return;
+	}
+
+	drawQueued();
+	u8 *pixels = lineCache->add(line, generation);
+
+	rotateRect(x, y, w, h);
+	adjustOffset(x, y);
+
+	u32 pitch = w * bytes_per_pixel;
+	for (; h--; y++, pixels += pitch) {
+		if (mScrollType == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		memcpy(pixels, mRenderBase + y * mRenderPitch + x * bytes_per_pixel, pitch);
+	}
+}
+
+u32 Screen::mWrapCount = 0;
+u32 Screen::mWrapUsecs = 0;
+
+bool Screen::wrapOffset(s32 delta)
+{
+	bool upright = (renderRotate() == Rotate0 || renderRotate() == Rotate180);
+	u32 size = (upright == (mScrollType == YPan)) ? mHeight : mWidth;
+	u32 dist = (delta < 0) ? -delta : delta;
+	if (dist > mOffsetMax || dist >= size) return false;
+
+	struct timeval start;
+	gettimeofday(&start, 0);
+
+	// move what stays visible to the other end of video memory, as if the window had been there
+	// all along, and pan from that end on
+	u32 pos = (delta > 0) ? 0 : mOffsetMax;
+	u32 first = (delta > 0) ? dist : 0, num = size - dist;
+	u32 from = mOffsetCur + first, to = pos + first;
+	bool vmem = (mShadowMem && mVcActive);
+
+	if (mScrollType == YPan) {
+		memmove(mRenderBase + to * mRenderPitch, mRenderBase + from * mRenderPitch, num * mRenderPitch);
+		if (vmem) memcpy(mVMemBase + to * mBytesPerLine, mShadowMem + to * mRenderPitch, num * mRenderPitch);
+	} else {
+		u32 lines = videoLines();
+		for (u32 y = 0; y < lines; y++) {
+			u8 *line = mRenderBase + y * mRenderPitch;
+			memmove(line + to * bytes_per_pixel, line + from * bytes_per_pixel, num * bytes_per_pixel);
+			if (vmem) memcpy(mVMemBase + y * mBytesPerLine + to * bytes_per_pixel, line + to * bytes_per_pixel, num * bytes_per_pixel);
+		}
+	}
+
+	mOffsetCur = pos + delta;
+
+	struct timeval end;
+	gettimeofday(&end, 0);
+	mWrapCount++;
+	mWrapUsecs += (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+	return true;
+}
+
+static inline void rotateCellRect(RotateType type, u32 W, u32 H, u32 &x, u32 &y, u32 &w, u32 &h)
+{
+	u32 tmp;
+	switch (type) {
+	case Rotate0:
+		break;
+
+	case Rotate90:
+		tmp = x;
+		x = H - y - h;
+		y = tmp;
+
+		tmp = w;
+		w = h;
+		h = tmp;
+		break;
+
+	case Rotate180:
+		x = W - x - w;
+		y = H - y - h;
+		break;
+
+	case Rotate270:
+		tmp = y;
+		y = W - x - w;
+		x = tmp;
+
+		tmp = w;
+		w = h;
+		h = tmp;
+		break;
+	}
 }
 
-void Screen::fillX(u32 x, u32 y, u32 w, u8 color)
+// coverage of a whole cell of glyph, lines of pitch bytes in the rotated layout, with the same
+// clipping as drawGlyph(), which glyph->left < 0 needs to be drawn by
+static void cellCoverage(u8 *dst, u32 pitch, Font::Glyph *glyph, RotateType rotate, u32 w, u32 h)
 {
-	u32 c = fillColors[color];
-	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+	s32 top = glyph->top;
+	if (top < 0) top = 0;
+
+	s32 left = glyph->left;
+
+	s32 width = glyph->width;
+	if (width > (s32)w - left) width = w - left;
+	if (width < 0) width = 0;
+
+	s32 height = glyph->height;
+	if (height > (s32)h - top) height = h - top;
+	if (height < 0) height = 0;
+
+	u32 x = left, y = top, nwidth = width, nheight = height;
+	rotateCellRect(rotate, w, h, x, y, nwidth, nheight);
+
+	u32 cw = w, ch = h;
+	if (rotate == Rotate90 || rotate == Rotate270) {
+		cw = h;
+		ch = w;
+	}
+
+	u8 *pixmap = glyph->pixmap;
+	u32 wdiff = glyph->width - width, hdiff = glyph->height - height;
+
+	if (wdiff) {
+		if (rotate == Rotate180) pixmap += wdiff;
+		else if (rotate == Rotate270) pixmap += wdiff * glyph->pitch;
+	}
+
+	if (hdiff) {
+		if (rotate == Rotate90) pixmap += hdiff;
+		else if (rotate == Rotate180) pixmap += hdiff * glyph->pitch;
+	}
+
+	for (u32 i = 0; i < ch; i++) {
+		memset(dst + i * pitch, 0, cw);
+	}
+
+	for (dst += y * pitch + x; nheight--; dst += pitch, pixmap += glyph->pitch) {
+		memcpy(dst, pixmap, nwidth);
+	}
+}
+
+// render a whole cell of glyph, including the background around it
+static void renderCell(u8 *pixels, Font::Glyph *glyph, RotateType rotate, u32 w, u32 h, const Color &fc, const Color &bc, u32 fpixel)
+{
+	u32 cw = w, ch = h;
+	if (rotate == Rotate90 || rotate == Rotate270) {
+		cw = h;
+		ch = w;
+	}
+
+	cellCoverage(cellAlpha, cw, glyph, rotate, w, h);
+
+	u32 pitch = cw * bytes_per_pixel;
+	u8 *alpha = cellAlpha;
+	for (; ch--; pixels += pitch, alpha += cw) {
+		kernels.blend(pixels, alpha, cw, fc, bc, fpixel);
+	}
+}
+
+// scalar row kernels, used for 8 bpp and when the cpu has no simd kernel, the color components
+// are where layout puts them
+
+template <u32 bits> struct PixelFormat;
+template <> struct PixelFormat<8> { typedef u8 type; };
+template <> struct PixelFormat<15> { typedef u16 type; };
+template <> struct PixelFormat<16> { typedef u16 type; };
+template <> struct PixelFormat<24> { typedef Pixel24 type; };
+template <> struct PixelFormat<32> { typedef u32 type; };
+
+template <u32 bpp>
+static inline void fillRow(u8 *dst, u32 w, u32 c)
+{
+	const u32 ppl = 4 / bpp, ppw = ppl >> 1, ppb = ppl >> 2;
 
 	// get better performance if write-combining not enabled for video memory
 	for (u32 i = w / ppl; i--; dst += 4) {
@@ -129,114 +839,567 @@ void Screen::fillX(u32 x, u32 y, u32 w, u8 color)
 	}
 }
 
-void Screen::fillXBg(u32 x, u32 y, u32 w, u8 color)
+template <>
+inline void fillRow<3>(u8 *dst, u32 w, u32 c)
 {
-	if (color == bgcolor) {
-		u32 offset = y * mBytesPerLine + x * bytes_per_pixel;
-		memcpy(mVMemBase + offset, bgimage_mem + offset, w * bytes_per_pixel);
+	// four pixels make three whole words
+	u32 w0 = c | (c << 24), w1 = (c >> 8) | (c << 16), w2 = (c >> 16) | (c << 8);
+
+	for (; w >= 4; w -= 4, dst += 12) {
+		writel(dst, w0);
+		writel(dst + 4, w1);
+		writel(dst + 8, w2);
+	}
+
+	for (; w--; dst += 3) {
+		*(volatile Pixel24 *)dst = c;
+	}
+}
+
+template <u32 bits>
+static inline u32 blendPixel(u8 pixel, u8 fc, u8 bc, const Color *palette)
+{
+	if (!pixel) return fillColors[bc];
+	if (pixel == 0xff) return fillColors[fc];
+
+	u8 red = palette[bc].red + (((palette[fc].red - palette[bc].red) * pixel) >> 8);
+	u8 green = palette[bc].green + (((palette[fc].green - palette[bc].green) * pixel) >> 8);
+	u8 blue = palette[bc].blue + (((palette[fc].blue - palette[bc].blue) * pixel) >> 8);
+
+	return packColor(red, green, blue);
+}
+
+template <>
+inline u32 blendPixel<8>(u8 pixel, u8 fc, u8 bc, const Color *palette)
+{
+	return fillColors[(pixel & 0x80) ? fc : bc];
+}
+
+template <u32 bits>
+static void blendRow(u8 *dst, const u8 *pixmap, u32 w, u8 fc, u8 bc, const Color *palette)
+{
+	typedef typename PixelFormat<bits>::type type;
+	type *pdst = (type *)dst;
+
+	for (; w--; pixmap++, pdst++) {
+		*(volatile type *)pdst = blendPixel<bits>(*pixmap, fc, bc, palette);
+	}
+}
+
+template <u32 bits>
+static void blendRowTable(u8 *dst, const u8 *pixmap, u32 w, const u32 *table)
+{
+	typedef typename PixelFormat<bits>::type type;
+	type *pdst = (type *)dst;
+
+	for (; w--; pixmap++, pdst++) {
+		*(volatile type *)pdst = table[*pixmap];
+	}
+}
+
+template <u32 bits>
+static void buildBlendTable(u32 *table, u8 fc, u8 bc, const Color *palette)
+{
+	for (u32 i = 0; i < 256; i++) {
+		table[i] = blendPixel<bits>(i, fc, bc, palette);
+	}
+}
+
+template <u32 bits>
+static void blendRowBg(u8 *dst, const u8 *bgimg, const u8 *pixmap, u32 w, u8 fc, const Color *palette)
+{
+	typedef typename PixelFormat<bits>::type type;
+
+	u8 red, green, blue;
+	u8 redbg, greenbg, bluebg;
+	u8 pixel;
+	u32 color;
+	type *pdst = (type *)dst;
+	const type *pbg = (const type *)bgimg;
+
+	for (; w--; pixmap++, pdst++, pbg++) {
+		pixel = *pixmap;
+
+		if (!pixel) color = *pbg;
+		else if (pixel == 0xff) color = fillColors[fc];
+		else {
+			color = *pbg;
+
+			redbg = unpackField(color, layout.red);
+			greenbg = unpackField(color, layout.green);
+			bluebg = unpackField(color, layout.blue);
+
+			red = redbg + (((palette[fc].red - redbg) * pixel) >> 8);
+			green = greenbg + (((palette[fc].green - greenbg) * pixel) >> 8);
+			blue = bluebg + (((palette[fc].blue - bluebg) * pixel) >> 8);
+
+			color = packColor(red, green, blue);
+		}
+
+		*(volatile type *)pdst = color;
+	}
+}
+
+template <>
+void blendRowBg<8>(u8 *dst, const u8 *bgimg, const u8 *pixmap, u32 w, u8 fc, const Color *palette)
+{
+	for (; w--; pixmap++, dst++, bgimg++) {
+		writeb(dst, (*pixmap & 0x80) ? fillColors[fc] : *bgimg);
+	}
+}
+
+// everything the drawing code used to look up per pixel row, fixed for the lifetime of the screen
+template <u32 Bits, RotateType Rotate, u32 Scroll, bool Bg>
+struct Pipeline {
+	static const u32 bits = Bits;
+	static const u32 bpp = (Bits == 15 ? 2 : Bits >> 3);
+	static const RotateType rotate = Rotate;
+	static const u32 scroll = Scroll;
+	static const bool bg = Bg;
+};
+
+template <class P>
+void Screen::adjustOffset(u32 &x, u32 &y)
+{
+	if (P::scroll == XPan) x += mOffsetCur;
+	else y += mOffsetCur;
+}
+
+template <class P>
+void Screen::fillSpan(u32 x, u32 y, u32 w, u8 color)
+{
+	u32 offset = y * mRenderPitch + x * P::bpp;
+
+	if (P::bg && color == bgcolor) memcpy(mRenderBase + offset, bgimage_mem + offset, w * P::bpp);
+	else fillRow<P::bpp>(mRenderBase + offset, w, fillColors[color]);
+}
+
+template <class P>
+void Screen::fillWide(u32 x, u32 y, u32 w, u32 h, u8 color)
+{
+	u32 size = w * h * P::bpp;
+	bool stream = (size >= streamSize);
+
+	if (w * P::bpp == mRenderPitch && (P::scroll != YWrap || y + h <= mOffsetMax + 1)) {
+		// whole lines follow each other in memory, fill them at once
+		fill(mRenderBase + y * mRenderPitch, size, fillColors[color], stream);
+		for (; h--; y++) damage(x, y, w);
+		return;
+	}
+
+	for (; h--; y++) {
+		if (P::scroll == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		fill(mRenderBase + y * mRenderPitch + x * P::bpp, w * P::bpp, fillColors[color], stream);
+		damage(x, y, w);
+	}
+}
+
+template <class P>
+void Screen::drawSpan(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap, const u32 *table)
+{
+	u32 offset = y * mRenderPitch + x * P::bpp;
+
+	if (P::bg && bc == bgcolor) {
+		if (P::bits != 8 && simdKernels) kernels.blendBg(mRenderBase + offset, bgimage_mem + offset, pixmap, w, kernelColors[fc], fillColors[fc]);
+		else blendRowBg<P::bits>(mRenderBase + offset, bgimage_mem + offset, pixmap, w, fc, mPalette);
+	} else if (table) {
+		blendRowTable<P::bits>(mRenderBase + offset, pixmap, w, table);
 	} else {
-		fillX(x, y, w, color);
+		if (P::bits != 8 && simdKernels) kernels.blend(mRenderBase + offset, pixmap, w, kernelColors[fc], kernelColors[bc], fillColors[fc]);
+		else blendRow<P::bits>(mRenderBase + offset, pixmap, w, fc, bc, mPalette);
+	}
+}
+
+template <class P>
+void Screen::fillRect(u32 x, u32 y, u32 w, u32 h, u8 color)
+{
+	if (x >= mWidth || y >= mHeight || !w || !h) return;
+	if (x + w > mWidth) w = mWidth - x;
+	if (y + h > mHeight) h = mHeight - y;
+
+	rotateCellRect(P::rotate, mWidth, mHeight, x, y, w, h);
+	adjustOffset<P>(x, y);
+
+	// spaces and glyph margins are a few pixels wide, wider fills go to the bulk kernel
+	if (w * P::bpp >= 64 && !(P::bg && color == bgcolor)) {
+		fillWide<P>(x, y, w, h, color);
+		return;
+	}
+
+	for (; h--; y++) {
+		if (P::scroll == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		fillSpan<P>(x, y, w, color);
+		damage(x, y, w);
 	}
 }
 
-void Screen::draw8(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap)
+template <class P>
+void Screen::renderText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
 {
-	bool isfg;
-	u8 *dst = mVMemBase + y * mBytesPerLine + x * bytes_per_pixel;
+	u32 startx, fw = mCellW;
 
-	for (; w--; pixmap++, dst++) {
-		isfg = (*pixmap & 0x80);
-		writeb(dst, fillColors[isfg ? fc : bc]);
+	u16 startnum, *starttext;
+	bool *startdw, draw_space = false, draw_text = false;
+
+	for (; num; num--, text++, dw++, x += fw) {
+		if (*text == 0x20) {
+			if (draw_text) {
+				draw_text = false;
+				drawGlyphs<P>(startx, y, fc, bc, startnum - num, starttext, startdw);
+			}
+
+			if (!draw_space) {
+				draw_space = true;
+				startx = x;
+			}
+		} else {
+			if (draw_space) {
+				draw_space = false;
+				fillRect<P>(startx, y, x - startx, mCellH, bc);
+			}
+
+			if (!draw_text) {
+				draw_text = true;
+				starttext = text;
+				startdw = dw;
+				startnum = num;
+				startx = x;
+			}
+
+			if (*dw) x += fw;
+		}
+	}
+
+	if (draw_text) {
+		drawGlyphs<P>(startx, y, fc, bc, startnum - num, starttext, startdw);
+	} else if (draw_space) {
+		fillRect<P>(startx, y, x - startx, mCellH, bc);
 	}
 }
 
-void Screen::draw8Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap)
+template <class P>
+void Screen::drawGlyphs(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
 {
-	if (bc != bgcolor) {
-		draw8(x, y, w, fc, bc, pixmap);
+	// with the screen rotated by 90 or 270 degrees, lines of a run are no longer than those of a glyph
+	if (P::bg && P::bits != 8 && (P::rotate == Rotate0 || P::rotate == Rotate180) && bc == bgcolor) {
+		drawGlyphsBg<P>(x, y, fc, num, text, dw);
 		return;
 	}
 
-	bool isfg;
-	u32 offset = y * mBytesPerLine + x * bytes_per_pixel;
-	u8 *dst = mVMemBase + offset;
-	u8 *bgimg = bgimage_mem + offset;
+	for (; num--; text++, dw++) {
+		drawGlyph<P>(x, y, fc, bc, *text, *dw);
+		x += *dw ? mCellW * 2 : mCellW;
+	}
+}
 
-	for (; w--; pixmap++, dst++, bgimg++) {
-		isfg = (*pixmap & 0x80);
-		writeb(dst, isfg ? fillColors[fc] : (*bgimg));
-	}
-}
-
-#define drawX(bits, lred, lgreen, lblue, type, fbwrite) \
- \
-void Screen::draw##bits(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap) \
-{ \
-	u8 red, green, blue; \
-	u8 pixel; \
-	type color; \
-	type *dst = (type *)(mVMemBase + y * mBytesPerLine + x * bytes_per_pixel); \
- \
-	for (; w--; pixmap++, dst++) { \
-		pixel = *pixmap; \
- \
-		if (!pixel) fbwrite(dst, fillColors[bc]); \
-		else if (pixel == 0xff) fbwrite(dst, fillColors[fc]); \
-		else { \
-			red = mPalette[bc].red + (((mPalette[fc].red - mPalette[bc].red) * pixel) >> 8); \
-			green = mPalette[bc].green + (((mPalette[fc].green - mPalette[bc].green) * pixel) >> 8); \
-			blue = mPalette[bc].blue + (((mPalette[fc].blue - mPalette[bc].blue) * pixel) >> 8); \
- \
-			color = ((red >> (8 - lred) << (lgreen + lblue)) | (green >> (8 - lgreen) << lblue) | (blue >> (8 - lblue))); \
-			fbwrite(dst, color); \
-		} \
-	} \
-}
-
-drawX(15, 5, 5, 5, u16, writew)
-drawX(16, 5, 6, 5, u16, writew)
-drawX(32, 8, 8, 8, u32, writel)
-
-#define drawXBg(bits, lred, lgreen, lblue, type, fbwrite) \
- \
-void Screen::draw##bits##Bg(u32 x, u32 y, u32 w, u8 fc, u8 bc, u8 *pixmap) \
-{ \
-	if (bc != bgcolor) { \
-		draw##bits(x, y, w, fc, bc, pixmap); \
-		return; \
-	} \
- \
-	u8 red, green, blue; \
-	u8 redbg, greenbg, bluebg; \
-	u8 pixel; \
-	type color; \
- \
-	u32 offset = y * mBytesPerLine + x * bytes_per_pixel; \
-	type *dst = (type *)(mVMemBase + offset); \
-	type *bgimg = (type *)(bgimage_mem + offset); \
- \
-	for (; w--; pixmap++, dst++, bgimg++) { \
-		pixel = *pixmap; \
- \
-		if (!pixel) fbwrite(dst, *bgimg); \
-		else if (pixel == 0xff) fbwrite(dst, fillColors[fc]); \
-		else { \
-			color = *bgimg; \
- \
-			redbg = ((color >> (lgreen + lblue)) & ((1 << lred) - 1)) << (8 - lred); \
-			greenbg = ((color >> lblue) & ((1 << lgreen) - 1)) << (8 - lgreen); \
-			bluebg = (color & ((1 << lblue) - 1)) << (8 - lblue); \
- \
-			red = redbg + (((mPalette[fc].red - redbg) * pixel) >> 8); \
-			green = greenbg + (((mPalette[fc].green - greenbg) * pixel) >> 8); \
-			blue = bluebg + (((mPalette[fc].blue - bluebg) * pixel) >> 8); \
- \
-			color = ((red >> (8 - lred) << (lgreen + lblue)) | (green >> (8 - lgreen) << lblue) | (blue >> (8 - lblue))); \
-			fbwrite(dst, color); \
-		} \
-	} \
-}
-
-drawXBg(15, 5, 5, 5, u16, writew)
-drawXBg(16, 5, 6, 5, u16, writew)
-drawXBg(32, 8, 8, 8, u32, writel)
+template <class P>
+void Screen::drawGlyphsBg(u32 x, u32 y, u8 fc, u16 num, u16 *text, bool *dw)
+{
+	// the glyphs of a run are put together into one coverage map, which is then blended with the
+	// background image a whole line of the run at a time, long enough for the simd kernels
+	u8 alpha[16384];
+	u32 h = mCellH;
+
+	while (num) {
+		u32 w = 0, n = 0;
+		Font::Glyph *glyphs[256];
+
+		for (; n < num && n < 256; n++) {
+			u32 cw = dw[n] ? mCellW * 2 : mCellW;
+			if (x + w + cw > mWidth || (w + cw) * h > sizeof(alpha)) break;
+
+			glyphs[n] = mBatchRunning ? Font::instance()->loadedGlyph(text[n]) : Font::instance()->getGlyph(text[n]);
+			// a glyph reaching into the cell on its left is left to drawGlyph()
+			if (glyphs[n] && glyphs[n]->left < 0) break;
+			w += cw;
+		}
+
+		if (!n || y + h > mHeight) {
+			drawGlyph<P>(x, y, fc, bgcolor, *text, *dw);
+			x += *dw ? mCellW * 2 : mCellW;
+			num--, text++, dw++;
+			continue;
+		}
+
+		u32 rx = x, ry = y, rw = w, rh = h;
+		rotateCellRect(P::rotate, mWidth, mHeight, rx, ry, rw, rh);
+
+		for (u32 i = 0, cx = 0; i < n; i++) {
+			u32 cw = dw[i] ? mCellW * 2 : mCellW;
+			u32 ox = cx, oy = 0, ow = cw, oh = h;
+			rotateCellRect(P::rotate, w, h, ox, oy, ow, oh);
+
+			u8 *dst = alpha + oy * rw + ox;
+			if (glyphs[i]) cellCoverage(dst, rw, glyphs[i], P::rotate, cw, h);
+			else for (u32 j = 0; j < oh; j++) memset(dst + j * rw, 0, ow);
+
+			cx += cw;
+		}
+
+		adjustOffset<P>(rx, ry);
+		u8 *pixmap = alpha;
+		for (; rh--; ry++, pixmap += rw) {
+			if (P::scroll == YWrap && ry > mOffsetMax) ry -= mOffsetMax + 1;
+			drawSpan<P>(rx, ry, rw, fc, bgcolor, pixmap, 0);
+			damage(rx, ry, rw);
+		}
+
+		x += w;
+		num -= n, text += n, dw += n;
+	}
+}
+
+template <class P>
+void Screen::drawGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw)
+{
+	if (x >= mWidth || y >= mHeight) return;
+	if (drawCachedGlyph<P>(x, y, fc, bc, code, dw)) return;
+
+	s32 w = (dw ? mCellW * 2 : mCellW), h = mCellH;
+	if (x + w > mWidth) w = mWidth - x;
+	if (y + h > mHeight) h = mHeight - y;
+
+	Font::Glyph *glyph = mBatchRunning ? Font::instance()->loadedGlyph(code) : Font::instance()->getGlyph(code);
+	if (!glyph) {
+		fillRect<P>(x, y, w, h, bc);
+		return;
+	}
+
+	s32 top = 0, left = 0, width = w, height = h;
+
+	// a glyph padded to the cell covers all of it, see pad-glyphs in font.cpp
+	if (glyph->left || glyph->top || glyph->width != w || glyph->height != h) {
+		top = glyph->top;
+		if (top < 0) top = 0;
+
+		left = glyph->left;
+		if ((s32)x + left < 0) left = -x;
+
+		width = glyph->width;
+		if (width > w - left) width = w - left;
+		if ((s32)x + left + width > (s32)mWidth) width = mWidth - ((s32)x + left);
+		if (width < 0) width = 0;
+
+		height = glyph->height;
+		if (height > h - top) height = h - top;
+		if (y + top + height > mHeight) height = mHeight - (y + top);
+		if (height < 0) height = 0;
+
+		if (top) fillRect<P>(x, y, w, top, bc);
+		if (left > 0) fillRect<P>(x, y + top, left, height, bc);
+
+		s32 right = width + left;
+		if (w > right) fillRect<P>((s32)x + right, y + top, w - right, height, bc);
+
+		s32 bot = top + height;
+		if (h > bot) fillRect<P>(x, y + bot, w, h - bot, bc);
+	}
+
+	x += left;
+	y += top;
+	if (x >= mWidth || y >= mHeight || !width || !height) return;
+
+	u32 nwidth = width, nheight = height;
+	rotateCellRect(P::rotate, mWidth, mHeight, x, y, nwidth, nheight);
+
+	u8 *pixmap = glyph->pixmap;
+	u32 wdiff = glyph->width - width, hdiff = glyph->height - height;
+
+	if (wdiff) {
+		if (P::rotate == Rotate180) pixmap += wdiff;
+		else if (P::rotate == Rotate270) pixmap += wdiff * glyph->pitch;
+	}
+
+	if (hdiff) {
+		if (P::rotate == Rotate90) pixmap += hdiff;
+		else if (P::rotate == Rotate180) pixmap += hdiff * glyph->pitch;
+	}
+
+	const u32 *table = (P::bg && bc == bgcolor) ? 0 : blendTable(fc, bc);
+
+	adjustOffset<P>(x, y);
+	for (; nheight--; y++, pixmap += glyph->pitch) {
+		if (P::scroll == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		drawSpan<P>(x, y, nwidth, fc, bc, pixmap, table);
+		damage(x, y, nwidth);
+	}
+}
+
+const u32 *Screen::blendTable(u8 fc, u8 bc)
+{
+	if (!blendTables) return 0;
+
+	// render threads only use the tables made when their text was queued
+	u32 pair = fc | (bc << 8);
+	if (mBatchRunning) return blendTables->peek(pair);
+
+	u32 *table = blendTables->find(pair);
+	if (table) return table;
+
+	table = blendTables->add(pair);
+	switch (mBitsPerPixel) {
+	case 8:
+		buildBlendTable<8>(table, fc, bc, mPalette);
+		break;
+	case 15:
+		buildBlendTable<15>(table, fc, bc, mPalette);
+		break;
+	case 16:
+		buildBlendTable<16>(table, fc, bc, mPalette);
+		break;
+	case 24:
+		buildBlendTable<24>(table, fc, bc, mPalette);
+		break;
+	case 32:
+		buildBlendTable<32>(table, fc, bc, mPalette);
+		break;
+	}
+
+	return table;
+}
+
+template <class P>
+u8 *Screen::cachedCell(u8 fc, u8 bc, u16 code, bool dw)
+{
+	// glyphs reaching into the left cell are drawn at their real position by drawGlyph()
+	Font::Glyph *glyph = Font::instance()->getGlyph(code);
+	if (!glyph || glyph->left < 0) return 0;
+
+	u32 w = (dw ? mCellW * 2 : mCellW), h = mCellH;
+	u32 attr = fc | (bc << 8) | (dw << 16);
+	u8 *pixels = colorCache->find(code, attr);
+
+	if (!pixels) {
+		pixels = colorCache->add(code, attr, w * h * P::bpp);
+		if (!pixels) return 0;
+
+		renderCell(pixels, glyph, P::rotate, w, h, kernelColors[fc], kernelColors[bc], fillColors[fc]);
+	}
+
+	return pixels;
+}
+
+template <class P>
+bool Screen::drawCachedGlyph(u32 x, u32 y, u8 fc, u8 bc, u16 code, bool dw)
+{
+	if (!colorCache || mBatchRunning || (P::bg && bc == bgcolor)) return false;
+
+	u32 w = (dw ? mCellW * 2 : mCellW), h = mCellH;
+	if (x + w > mWidth || y + h > mHeight) return false;
+
+	u8 *pixels = cachedCell<P>(fc, bc, code, dw);
+	if (!pixels) return false;
+
+	rotateCellRect(P::rotate, mWidth, mHeight, x, y, w, h);
+	adjustOffset<P>(x, y);
+
+	u32 pitch = w * P::bpp;
+	for (; h--; y++, pixels += pitch) {
+		if (P::scroll == YWrap && y > mOffsetMax) y -= mOffsetMax + 1;
+		memcpy(mRenderBase + y * mRenderPitch + x * P::bpp, pixels, pitch);
+		damage(x, y, w);
+	}
+
+	return true;
+}
+
+template <class P>
+void Screen::renderRow(u32 x, u32 y, u16 num, u16 *text, bool *dw, u8 *fc, u8 *bc)
+{
+	u32 w = 0;
+	for (u16 i = 0; i < num; i++) {
+		w += dw[i] ? mCellW * 2 : mCellW;
+	}
+
+	// the row is copied from the color cache a scanline at a time, so that video memory is written
+	// in long runs from left to right, which needs all cells of the row to fit in the cache at once
+	if (P::bg || (P::rotate != Rotate0 && P::rotate != Rotate180) || !colorCache
+		|| x + w > mWidth || y + mCellH > mHeight || w * mCellH * P::bpp > colorCache->maxBytes()) {
+		for (u16 start = 0, i = 1; i <= num; i++) {
+			if (i < num && fc[i] == fc[start] && bc[i] == bc[start]) continue;
+
+			renderText<P>(x, y, fc[start], bc[start], i - start, text + start, dw + start);
+			for (; start < i; start++) x += dw[start] ? mCellW * 2 : mCellW;
+		}
+		return;
+	}
+
+	u8 *pixels[num];
+	for (u16 i = 0; i < num; i++) {
+		pixels[i] = (text[i] == 0x20) ? 0 : cachedCell<P>(fc[i], bc[i], text[i], dw[i]);
+	}
+
+	u32 rx = x, ry = y, rw = w, rh = mCellH;
+	rotateCellRect(P::rotate, mWidth, mHeight, rx, ry, rw, rh);
+	adjustOffset<P>(rx, ry);
+
+	for (u32 line = 0; line < rh; line++, ry++) {
+		if (P::scroll == YWrap && ry > mOffsetMax) ry -= mOffsetMax + 1;
+
+		// rotated by 180 degrees, the last cell comes first in video memory
+		u32 cx = rx;
+		for (u16 k = 0; k < num; k++) {
+			u16 i = (P::rotate == Rotate180) ? num - 1 - k : k;
+			u32 cw = dw[i] ? mCellW * 2 : mCellW;
+
+			if (pixels[i]) memcpy(mRenderBase + ry * mRenderPitch + cx * P::bpp, pixels[i] + line * cw * P::bpp, cw * P::bpp);
+			else if (text[i] == 0x20) fillSpan<P>(cx, ry, cw, bc[i]);
+			cx += cw;
+		}
+
+		damage(rx, ry, rw);
+	}
+
+	// the rest may reach into the cell on the left, so it goes on top of the copied cells
+	for (u16 i = 0; i < num; x += dw[i] ? mCellW * 2 : mCellW, i++) {
+		if (!pixels[i] && text[i] != 0x20) drawGlyph<P>(x, y, fc[i], bc[i], text[i], dw[i]);
+	}
+}
+
+#define setPipeline(scroll, bg) \
+	mRenderText = &Screen::renderText<Pipeline<bits, rotate, scroll, bg> >; \
+	mRenderRow = &Screen::renderRow<Pipeline<bits, rotate, scroll, bg> >; \
+	mFillRect = &Screen::fillRect<Pipeline<bits, rotate, scroll, bg> >
+
+template <u32 bits, RotateType rotate>
+void Screen::selectScroll(bool bg)
+{
+	// background image mode always redraws, see initFillDraw()
+	if (bg) {
+		setPipeline(Redraw, true);
+		return;
+	}
+
+	switch (mScrollType) {
+	case Redraw:
+	case YPan:
+		// mOffsetCur stays 0 without scrolling, so redrawing needs no code of its own
+		setPipeline(YPan, false);
+		break;
+	case YWrap:
+		setPipeline(YWrap, false);
+		break;
+	case XPan:
+		setPipeline(XPan, false);
+		break;
+	}
+}
+
+template <u32 bits>
+void Screen::selectRotate(RotateType rotate, bool bg)
+{
+	switch (rotate) {
+	case Rotate0:
+		selectScroll<bits, Rotate0>(bg);
+		break;
+	case Rotate90:
+		selectScroll<bits, Rotate90>(bg);
+		break;
+	case Rotate180:
+		selectScroll<bits, Rotate180>(bg);
+		break;
+	case Rotate270:
+		selectScroll<bits, Rotate270>(bg);
+		break;
+	}
+}
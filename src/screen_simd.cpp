@@ -0,0 +1,888 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include "config.h"
+#include "screen_simd.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+// all kernels must produce exactly the same pixels as drawX/drawXBg in screen_render.cpp:
+// c = bg + (((fg - bg) * alpha) >> 8), alpha 0xff means foreground, alpha 0 means background
+
+static inline u8 mix(u8 bg, u8 fg, u8 alpha)
+{
+	return bg + (((fg - bg) * alpha) >> 8);
+}
+
+template <u32 bits> static inline u32 packPixel(u8 red, u8 green, u8 blue);
+template <u32 bits> static inline void unpackPixel(u32 color, u8 &red, u8 &green, u8 &blue);
+
+template <> inline u32 packPixel<15>(u8 red, u8 green, u8 blue)
+{
+	return ((red >> 3) << 10) | ((green >> 3) << 5) | (blue >> 3);
+}
+
+template <> inline u32 packPixel<16>(u8 red, u8 green, u8 blue)
+{
+	return ((red >> 3) << 11) | ((green >> 2) << 5) | (blue >> 3);
+}
+
+template <> inline u32 packPixel<32>(u8 red, u8 green, u8 blue)
+{
+	return (red << 16) | (green << 8) | blue;
+}
+
+template <> inline u32 packPixel<24>(u8 red, u8 green, u8 blue)
+{
+	return (red << 16) | (green << 8) | blue;
+}
+
+// LayoutOther, whatever getSimdKernels() was last given
+static PixelLayout otherLayout;
+
+template <> inline u32 packPixel<0>(u8 red, u8 green, u8 blue)
+{
+	return packField(red, otherLayout.red) | packField(green, otherLayout.green) | packField(blue, otherLayout.blue);
+}
+
+template <> inline void unpackPixel<15>(u32 color, u8 &red, u8 &green, u8 &blue)
+{
+	red = ((color >> 10) & 0x1f) << 3;
+	green = ((color >> 5) & 0x1f) << 3;
+	blue = (color & 0x1f) << 3;
+}
+
+template <> inline void unpackPixel<16>(u32 color, u8 &red, u8 &green, u8 &blue)
+{
+	red = ((color >> 11) & 0x1f) << 3;
+	green = ((color >> 5) & 0x3f) << 2;
+	blue = (color & 0x1f) << 3;
+}
+
+template <> inline void unpackPixel<32>(u32 color, u8 &red, u8 &green, u8 &blue)
+{
+	red = (color >> 16) & 0xff;
+	green = (color >> 8) & 0xff;
+	blue = color & 0xff;
+}
+
+template <> inline void unpackPixel<24>(u32 color, u8 &red, u8 &green, u8 &blue)
+{
+	unpackPixel<32>(color, red, green, blue);
+}
+
+template <> inline void unpackPixel<0>(u32 color, u8 &red, u8 &green, u8 &blue)
+{
+	red = unpackField(color, otherLayout.red);
+	green = unpackField(color, otherLayout.green);
+	blue = unpackField(color, otherLayout.blue);
+}
+
+template <u32 bits, typename type>
+static inline void blendScalar(type *dst, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel)
+{
+	for (; w--; pixmap++, dst++) {
+		u8 pixel = *pixmap;
+
+		if (pixel == 0xff) *dst = fpixel;
+		else *dst = packPixel<bits>(mix(bc.red, fc.red, pixel), mix(bc.green, fc.green, pixel), mix(bc.blue, fc.blue, pixel));
+	}
+}
+
+template <u32 bits, typename type>
+static inline void blendBgScalar(type *dst, const type *bgimg, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel)
+{
+	u8 red, green, blue;
+
+	for (; w--; pixmap++, dst++, bgimg++) {
+		u8 pixel = *pixmap;
+
+		if (!pixel) *dst = *bgimg;
+		else if (pixel == 0xff) *dst = fpixel;
+		else {
+			unpackPixel<bits>(*bgimg, red, green, blue);
+			*dst = packPixel<bits>(mix(red, fc.red, pixel), mix(green, fc.green, pixel), mix(blue, fc.blue, pixel));
+		}
+	}
+}
+
+template <u32 bits, typename type>
+static void blendNone(u8 *dst, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel)
+{
+	blendScalar<bits>((type *)dst, pixmap, w, fc, bc, fpixel);
+}
+
+template <u32 bits, typename type>
+static void blendBgNone(u8 *dst, const u8 *bgimg, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel)
+{
+	blendBgScalar<bits>((type *)dst, (const type *)bgimg, pixmap, w, fc, fpixel);
+}
+
+template <typename type>
+static void transposeNone(u8 *dst, s32 dpitch, const u8 *src, s32 spitch, u32 w, u32 h)
+{
+	for (u32 x = 0; x < w; x++, dst += dpitch) {
+		const u8 *s = src + x * sizeof(type);
+		for (u32 y = 0; y < h; y++, s += spitch) {
+			((type *)dst)[y] = *(const type *)s;
+		}
+	}
+}
+
+static void fill24None(u8 *dst, u32 size, u32 pattern, bool stream)
+{
+	// four pixels make three whole words
+	u32 w0 = pattern | (pattern << 24), w1 = (pattern >> 8) | (pattern << 16), w2 = (pattern >> 16) | (pattern << 8);
+
+	for (; size >= 12; size -= 12, dst += 12) {
+		*(volatile u32 *)dst = w0;
+		*(volatile u32 *)(dst + 4) = w1;
+		*(volatile u32 *)(dst + 8) = w2;
+	}
+
+	for (; size >= 3; size -= 3, dst += 3) {
+		*(volatile Pixel24 *)dst = pattern;
+	}
+}
+
+static void fillNone(u8 *dst, u32 size, u32 pattern, bool stream)
+{
+	// pixels of 8 and 16 bpp are repeated in the pattern, any pixel boundary starts it right
+	if (((long)dst & 1) && size) {
+		*(volatile u8 *)dst = pattern;
+		dst++, size--;
+	}
+
+	if (((long)dst & 2) && size >= 2) {
+		*(volatile u16 *)dst = pattern;
+		dst += 2, size -= 2;
+	}
+
+	for (; size >= 4; size -= 4, dst += 4) {
+		*(volatile u32 *)dst = pattern;
+	}
+
+	if (size & 2) {
+		*(volatile u16 *)dst = pattern;
+		dst += 2;
+	}
+
+	if (size & 1) {
+		*(volatile u8 *)dst = pattern;
+	}
+}
+
+#ifdef SIMD_X86
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+// (fg - bg) * alpha may overflow 16 bits, so the difference is blended with its absolute value
+// and negated afterwards, floor(-x / 256) is computed as -((x + 255) >> 8).
+
+struct Channel128 {
+	__m128i base, diff, sign, bias;
+};
+
+static inline SSE2 void initChannel(Channel128 &c, u8 fg, u8 bg)
+{
+	c.base = _mm_set1_epi16(bg);
+	c.diff = _mm_set1_epi16(fg > bg ? fg - bg : bg - fg);
+	c.sign = _mm_set1_epi16(fg < bg ? -1 : 0);
+	c.bias = _mm_set1_epi16(fg < bg ? 0xff : 0);
+}
+
+static inline SSE2 __m128i mixChannel(const Channel128 &c, __m128i alpha)
+{
+	__m128i t = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(alpha, c.diff), c.bias), 8);
+	return _mm_add_epi16(c.base, _mm_sub_epi16(_mm_xor_si128(t, c.sign), c.sign));
+}
+
+static inline SSE2 __m128i mixVar(__m128i bg, __m128i fg, __m128i alpha)
+{
+	__m128i diff = _mm_sub_epi16(fg, bg);
+	__m128i sign = _mm_srai_epi16(diff, 15);
+	diff = _mm_sub_epi16(_mm_xor_si128(diff, sign), sign);
+
+	__m128i t = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(alpha, diff), _mm_and_si128(sign, _mm_set1_epi16(0xff))), 8);
+	return _mm_add_epi16(bg, _mm_sub_epi16(_mm_xor_si128(t, sign), sign));
+}
+
+static inline SSE2 __m128i select128(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline SSE2 __m128i pack15x8(__m128i red, __m128i green, __m128i blue)
+{
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(red, 3), 10),
+		_mm_slli_epi16(_mm_srli_epi16(green, 3), 5)), _mm_srli_epi16(blue, 3));
+}
+
+static inline SSE2 __m128i pack16x8(__m128i red, __m128i green, __m128i blue)
+{
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(red, 3), 11),
+		_mm_slli_epi16(_mm_srli_epi16(green, 2), 5)), _mm_srli_epi16(blue, 3));
+}
+
+static inline SSE2 void unpack15x8(__m128i c, __m128i &red, __m128i &green, __m128i &blue)
+{
+	__m128i mask = _mm_set1_epi16(0x1f);
+	red = _mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(c, 10), mask), 3);
+	green = _mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(c, 5), mask), 3);
+	blue = _mm_slli_epi16(_mm_and_si128(c, mask), 3);
+}
+
+static inline SSE2 void unpack16x8(__m128i c, __m128i &red, __m128i &green, __m128i &blue)
+{
+	red = _mm_slli_epi16(_mm_srli_epi16(c, 11), 3);
+	green = _mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(c, 5), _mm_set1_epi16(0x3f)), 2);
+	blue = _mm_slli_epi16(_mm_and_si128(c, _mm_set1_epi16(0x1f)), 3);
+}
+
+#define blendSse2X(bits) \
+ \
+static SSE2 void blend##bits##Sse2(u8 *dst8, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel) \
+{ \
+	u16 *dst = (u16 *)dst8; \
+	Channel128 red, green, blue; \
+	initChannel(red, fc.red, bc.red); \
+	initChannel(green, fc.green, bc.green); \
+	initChannel(blue, fc.blue, bc.blue); \
+ \
+	__m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(0xff), fg = _mm_set1_epi16(fpixel); \
+ \
+	for (; w >= 8; w -= 8, pixmap += 8, dst += 8) { \
+		__m128i alpha = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pixmap), zero); \
+		__m128i color = pack##bits##x8(mixChannel(red, alpha), mixChannel(green, alpha), mixChannel(blue, alpha)); \
+		_mm_storeu_si128((__m128i *)dst, select128(_mm_cmpeq_epi16(alpha, full), fg, color)); \
+	} \
+ \
+	blendScalar<bits>(dst, pixmap, w, fc, bc, fpixel); \
+} \
+ \
+static SSE2 void blend##bits##BgSse2(u8 *dst8, const u8 *bgimg8, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel) \
+{ \
+	u16 *dst = (u16 *)dst8; \
+	const u16 *bgimg = (const u16 *)bgimg8; \
+	__m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(0xff), fg = _mm_set1_epi16(fpixel); \
+	__m128i fred = _mm_set1_epi16(fc.red), fgreen = _mm_set1_epi16(fc.green), fblue = _mm_set1_epi16(fc.blue); \
+	__m128i red, green, blue; \
+ \
+	for (; w >= 8; w -= 8, pixmap += 8, dst += 8, bgimg += 8) { \
+		__m128i alpha = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pixmap), zero); \
+		__m128i bg = _mm_loadu_si128((const __m128i *)bgimg); \
+		unpack##bits##x8(bg, red, green, blue); \
+ \
+		__m128i color = pack##bits##x8(mixVar(red, fred, alpha), mixVar(green, fgreen, alpha), mixVar(blue, fblue, alpha)); \
+		color = select128(_mm_cmpeq_epi16(alpha, full), fg, color); \
+		_mm_storeu_si128((__m128i *)dst, select128(_mm_cmpeq_epi16(alpha, zero), bg, color)); \
+	} \
+ \
+	blendBgScalar<bits>(dst, bgimg, pixmap, w, fc, fpixel); \
+}
+
+blendSse2X(15)
+blendSse2X(16)
+
+static SSE2 void blend32Sse2(u8 *dst8, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel)
+{
+	u32 *dst = (u32 *)dst8;
+	Channel128 red, green, blue;
+	initChannel(red, fc.red, bc.red);
+	initChannel(green, fc.green, bc.green);
+	initChannel(blue, fc.blue, bc.blue);
+
+	__m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(0xff), fg = _mm_set1_epi32(fpixel);
+
+	for (; w >= 8; w -= 8, pixmap += 8, dst += 8) {
+		__m128i alpha = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pixmap), zero);
+		__m128i gb = _mm_or_si128(_mm_slli_epi16(mixChannel(green, alpha), 8), mixChannel(blue, alpha));
+		__m128i r = mixChannel(red, alpha);
+		__m128i mask = _mm_cmpeq_epi16(alpha, full);
+
+		_mm_storeu_si128((__m128i *)dst, select128(_mm_unpacklo_epi16(mask, mask), fg, _mm_unpacklo_epi16(gb, r)));
+		_mm_storeu_si128((__m128i *)(dst + 4), select128(_mm_unpackhi_epi16(mask, mask), fg, _mm_unpackhi_epi16(gb, r)));
+	}
+
+	blendScalar<32>(dst, pixmap, w, fc, bc, fpixel);
+}
+
+static SSE2 void blend32BgSse2(u8 *dst8, const u8 *bgimg8, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel)
+{
+	u32 *dst = (u32 *)dst8;
+	const u32 *bgimg = (const u32 *)bgimg8;
+	__m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(0xff), fg = _mm_set1_epi32(fpixel), byte = _mm_set1_epi32(0xff);
+	__m128i fred = _mm_set1_epi16(fc.red), fgreen = _mm_set1_epi16(fc.green), fblue = _mm_set1_epi16(fc.blue);
+
+	for (; w >= 8; w -= 8, pixmap += 8, dst += 8, bgimg += 8) {
+		__m128i alpha = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pixmap), zero);
+		__m128i bg0 = _mm_loadu_si128((const __m128i *)bgimg), bg1 = _mm_loadu_si128((const __m128i *)(bgimg + 4));
+
+		__m128i r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(bg0, 16), byte), _mm_and_si128(_mm_srli_epi32(bg1, 16), byte));
+		__m128i g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(bg0, 8), byte), _mm_and_si128(_mm_srli_epi32(bg1, 8), byte));
+		__m128i b = _mm_packs_epi32(_mm_and_si128(bg0, byte), _mm_and_si128(bg1, byte));
+
+		r = mixVar(r, fred, alpha);
+		__m128i gb = _mm_or_si128(_mm_slli_epi16(mixVar(g, fgreen, alpha), 8), mixVar(b, fblue, alpha));
+
+		__m128i mask = _mm_cmpeq_epi16(alpha, full), zmask = _mm_cmpeq_epi16(alpha, zero);
+		__m128i lo = select128(_mm_unpacklo_epi16(mask, mask), fg, _mm_unpacklo_epi16(gb, r));
+		__m128i hi = select128(_mm_unpackhi_epi16(mask, mask), fg, _mm_unpackhi_epi16(gb, r));
+
+		_mm_storeu_si128((__m128i *)dst, select128(_mm_unpacklo_epi16(zmask, zmask), bg0, lo));
+		_mm_storeu_si128((__m128i *)(dst + 4), select128(_mm_unpackhi_epi16(zmask, zmask), bg1, hi));
+	}
+
+	blendBgScalar<32>(dst, bgimg, pixmap, w, fc, fpixel);
+}
+
+// the blocks are transposed in registers, leftover rows and columns go through transposeNone()
+
+static SSE2 void transpose16Sse2(u8 *dst, s32 dpitch, const u8 *src, s32 spitch, u32 w, u32 h)
+{
+	u32 bw = w & ~7, bh = h & ~7;
+
+	for (u32 x = 0; x < bw; x += 8) {
+		for (u32 y = 0; y < bh; y += 8) {
+			const u8 *s = src + (s32)y * spitch + x * 2;
+			__m128i r[8], t[8], u[8];
+
+			for (u32 i = 0; i < 8; i++) {
+				r[i] = _mm_loadu_si128((const __m128i *)(s + (s32)i * spitch));
+			}
+
+			for (u32 i = 0; i < 4; i++) {
+				t[i * 2] = _mm_unpacklo_epi16(r[i * 2], r[i * 2 + 1]);
+				t[i * 2 + 1] = _mm_unpackhi_epi16(r[i * 2], r[i * 2 + 1]);
+			}
+
+			for (u32 i = 0; i < 2; i++) {
+				u[i * 4] = _mm_unpacklo_epi32(t[i * 4], t[i * 4 + 2]);
+				u[i * 4 + 1] = _mm_unpackhi_epi32(t[i * 4], t[i * 4 + 2]);
+				u[i * 4 + 2] = _mm_unpacklo_epi32(t[i * 4 + 1], t[i * 4 + 3]);
+				u[i * 4 + 3] = _mm_unpackhi_epi32(t[i * 4 + 1], t[i * 4 + 3]);
+			}
+
+			u8 *d = dst + (s32)x * dpitch + y * 2;
+			for (u32 i = 0; i < 4; i++, d += dpitch * 2) {
+				_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi64(u[i], u[i + 4]));
+				_mm_storeu_si128((__m128i *)(d + dpitch), _mm_unpackhi_epi64(u[i], u[i + 4]));
+			}
+		}
+	}
+
+	transposeNone<u16>(dst + bh * 2, dpitch, src + (s32)bh * spitch, spitch, bw, h - bh);
+	transposeNone<u16>(dst + (s32)bw * dpitch, dpitch, src + bw * 2, spitch, w - bw, h);
+}
+
+static SSE2 void transpose32Sse2(u8 *dst, s32 dpitch, const u8 *src, s32 spitch, u32 w, u32 h)
+{
+	u32 bw = w & ~3, bh = h & ~3;
+
+	for (u32 x = 0; x < bw; x += 4) {
+		for (u32 y = 0; y < bh; y += 4) {
+			const u8 *s = src + (s32)y * spitch + x * 4;
+			__m128i r0 = _mm_loadu_si128((const __m128i *)s);
+			__m128i r1 = _mm_loadu_si128((const __m128i *)(s + spitch));
+			__m128i r2 = _mm_loadu_si128((const __m128i *)(s + spitch * 2));
+			__m128i r3 = _mm_loadu_si128((const __m128i *)(s + spitch * 3));
+
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+			__m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+
+			u8 *d = dst + (s32)x * dpitch + y * 4;
+			_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi64(t0, t1));
+			_mm_storeu_si128((__m128i *)(d + dpitch), _mm_unpackhi_epi64(t0, t1));
+			_mm_storeu_si128((__m128i *)(d + dpitch * 2), _mm_unpacklo_epi64(t2, t3));
+			_mm_storeu_si128((__m128i *)(d + dpitch * 3), _mm_unpackhi_epi64(t2, t3));
+		}
+	}
+
+	transposeNone<u32>(dst + bh * 4, dpitch, src + (s32)bh * spitch, spitch, bw, h - bh);
+	transposeNone<u32>(dst + (s32)bw * dpitch, dpitch, src + bw * 4, spitch, w - bw, h);
+}
+
+struct Channel256 {
+	__m256i base, diff, sign, bias;
+};
+
+static inline AVX2 void initChannel(Channel256 &c, u8 fg, u8 bg)
+{
+	c.base = _mm256_set1_epi16(bg);
+	c.diff = _mm256_set1_epi16(fg > bg ? fg - bg : bg - fg);
+	c.sign = _mm256_set1_epi16(fg < bg ? -1 : 0);
+	c.bias = _mm256_set1_epi16(fg < bg ? 0xff : 0);
+}
+
+static inline AVX2 __m256i mixChannel(const Channel256 &c, __m256i alpha)
+{
+	__m256i t = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(alpha, c.diff), c.bias), 8);
+	return _mm256_add_epi16(c.base, _mm256_sub_epi16(_mm256_xor_si256(t, c.sign), c.sign));
+}
+
+static inline AVX2 __m256i mixVar(__m256i bg, __m256i fg, __m256i alpha)
+{
+	__m256i diff = _mm256_sub_epi16(fg, bg);
+	__m256i sign = _mm256_srai_epi16(diff, 15);
+	diff = _mm256_abs_epi16(diff);
+
+	__m256i t = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(alpha, diff), _mm256_and_si256(sign, _mm256_set1_epi16(0xff))), 8);
+	return _mm256_add_epi16(bg, _mm256_sub_epi16(_mm256_xor_si256(t, sign), sign));
+}
+
+static inline AVX2 __m256i pack15x16(__m256i red, __m256i green, __m256i blue)
+{
+	return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_srli_epi16(red, 3), 10),
+		_mm256_slli_epi16(_mm256_srli_epi16(green, 3), 5)), _mm256_srli_epi16(blue, 3));
+}
+
+static inline AVX2 __m256i pack16x16(__m256i red, __m256i green, __m256i blue)
+{
+	return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi16(_mm256_srli_epi16(red, 3), 11),
+		_mm256_slli_epi16(_mm256_srli_epi16(green, 2), 5)), _mm256_srli_epi16(blue, 3));
+}
+
+static inline AVX2 void unpack15x16(__m256i c, __m256i &red, __m256i &green, __m256i &blue)
+{
+	__m256i mask = _mm256_set1_epi16(0x1f);
+	red = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(c, 10), mask), 3);
+	green = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(c, 5), mask), 3);
+	blue = _mm256_slli_epi16(_mm256_and_si256(c, mask), 3);
+}
+
+static inline AVX2 void unpack16x16(__m256i c, __m256i &red, __m256i &green, __m256i &blue)
+{
+	red = _mm256_slli_epi16(_mm256_srli_epi16(c, 11), 3);
+	green = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(c, 5), _mm256_set1_epi16(0x3f)), 2);
+	blue = _mm256_slli_epi16(_mm256_and_si256(c, _mm256_set1_epi16(0x1f)), 3);
+}
+
+#define blendAvx2X(bits) \
+ \
+static AVX2 void blend##bits##Avx2(u8 *dst8, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel) \
+{ \
+	u16 *dst = (u16 *)dst8; \
+	Channel256 red, green, blue; \
+	initChannel(red, fc.red, bc.red); \
+	initChannel(green, fc.green, bc.green); \
+	initChannel(blue, fc.blue, bc.blue); \
+ \
+	__m256i full = _mm256_set1_epi16(0xff), fg = _mm256_set1_epi16(fpixel); \
+ \
+	for (; w >= 16; w -= 16, pixmap += 16, dst += 16) { \
+		__m256i alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)pixmap)); \
+		__m256i color = pack##bits##x16(mixChannel(red, alpha), mixChannel(green, alpha), mixChannel(blue, alpha)); \
+		_mm256_storeu_si256((__m256i *)dst, _mm256_blendv_epi8(color, fg, _mm256_cmpeq_epi16(alpha, full))); \
+	} \
+ \
+	blendScalar<bits>(dst, pixmap, w, fc, bc, fpixel); \
+} \
+ \
+static AVX2 void blend##bits##BgAvx2(u8 *dst8, const u8 *bgimg8, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel) \
+{ \
+	u16 *dst = (u16 *)dst8; \
+	const u16 *bgimg = (const u16 *)bgimg8; \
+	__m256i zero = _mm256_setzero_si256(), full = _mm256_set1_epi16(0xff), fg = _mm256_set1_epi16(fpixel); \
+	__m256i fred = _mm256_set1_epi16(fc.red), fgreen = _mm256_set1_epi16(fc.green), fblue = _mm256_set1_epi16(fc.blue); \
+	__m256i red, green, blue; \
+ \
+	for (; w >= 16; w -= 16, pixmap += 16, dst += 16, bgimg += 16) { \
+		__m256i alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)pixmap)); \
+		__m256i bg = _mm256_loadu_si256((const __m256i *)bgimg); \
+		unpack##bits##x16(bg, red, green, blue); \
+ \
+		__m256i color = pack##bits##x16(mixVar(red, fred, alpha), mixVar(green, fgreen, alpha), mixVar(blue, fblue, alpha)); \
+		color = _mm256_blendv_epi8(color, fg, _mm256_cmpeq_epi16(alpha, full)); \
+		_mm256_storeu_si256((__m256i *)dst, _mm256_blendv_epi8(color, bg, _mm256_cmpeq_epi16(alpha, zero))); \
+	} \
+ \
+	blendBgScalar<bits>(dst, bgimg, pixmap, w, fc, fpixel); \
+}
+
+blendAvx2X(15)
+blendAvx2X(16)
+
+// 256-bit unpack works inside 128-bit lanes, permute the results back to pixel order
+#define AVX2_LO(lo, hi) _mm256_permute2x128_si256(lo, hi, 0x20)
+#define AVX2_HI(lo, hi) _mm256_permute2x128_si256(lo, hi, 0x31)
+
+static AVX2 void blend32Avx2(u8 *dst8, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel)
+{
+	u32 *dst = (u32 *)dst8;
+	Channel256 red, green, blue;
+	initChannel(red, fc.red, bc.red);
+	initChannel(green, fc.green, bc.green);
+	initChannel(blue, fc.blue, bc.blue);
+
+	__m256i full = _mm256_set1_epi16(0xff), fg = _mm256_set1_epi32(fpixel);
+
+	for (; w >= 16; w -= 16, pixmap += 16, dst += 16) {
+		__m256i alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)pixmap));
+		__m256i gb = _mm256_or_si256(_mm256_slli_epi16(mixChannel(green, alpha), 8), mixChannel(blue, alpha));
+		__m256i r = mixChannel(red, alpha);
+		__m256i mask = _mm256_cmpeq_epi16(alpha, full);
+
+		__m256i lo = _mm256_blendv_epi8(_mm256_unpacklo_epi16(gb, r), fg, _mm256_unpacklo_epi16(mask, mask));
+		__m256i hi = _mm256_blendv_epi8(_mm256_unpackhi_epi16(gb, r), fg, _mm256_unpackhi_epi16(mask, mask));
+
+		_mm256_storeu_si256((__m256i *)dst, AVX2_LO(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + 8), AVX2_HI(lo, hi));
+	}
+
+	blendScalar<32>(dst, pixmap, w, fc, bc, fpixel);
+}
+
+static AVX2 void blend32BgAvx2(u8 *dst8, const u8 *bgimg8, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel)
+{
+	u32 *dst = (u32 *)dst8;
+	const u32 *bgimg = (const u32 *)bgimg8;
+	__m256i zero = _mm256_setzero_si256(), full = _mm256_set1_epi16(0xff), fg = _mm256_set1_epi32(fpixel), byte = _mm256_set1_epi32(0xff);
+	__m256i fred = _mm256_set1_epi16(fc.red), fgreen = _mm256_set1_epi16(fc.green), fblue = _mm256_set1_epi16(fc.blue);
+
+	for (; w >= 16; w -= 16, pixmap += 16, dst += 16, bgimg += 16) {
+		__m256i alpha = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)pixmap));
+		__m256i bg0 = _mm256_loadu_si256((const __m256i *)bgimg), bg1 = _mm256_loadu_si256((const __m256i *)(bgimg + 8));
+
+		#define CHANNEL(shift) _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(bg0, shift), byte), \
+			_mm256_and_si256(_mm256_srli_epi32(bg1, shift), byte)), 0xd8)
+
+		__m256i r = mixVar(CHANNEL(16), fred, alpha);
+		__m256i gb = _mm256_or_si256(_mm256_slli_epi16(mixVar(CHANNEL(8), fgreen, alpha), 8), mixVar(CHANNEL(0), fblue, alpha));
+
+		#undef CHANNEL
+
+		__m256i mask = _mm256_cmpeq_epi16(alpha, full), zmask = _mm256_cmpeq_epi16(alpha, zero);
+		__m256i lo = _mm256_blendv_epi8(_mm256_unpacklo_epi16(gb, r), fg, _mm256_unpacklo_epi16(mask, mask));
+		__m256i hi = _mm256_blendv_epi8(_mm256_unpackhi_epi16(gb, r), fg, _mm256_unpackhi_epi16(mask, mask));
+		__m256i zlo = _mm256_unpacklo_epi16(zmask, zmask), zhi = _mm256_unpackhi_epi16(zmask, zmask);
+
+		_mm256_storeu_si256((__m256i *)dst, _mm256_blendv_epi8(AVX2_LO(lo, hi), bg0, AVX2_LO(zlo, zhi)));
+		_mm256_storeu_si256((__m256i *)(dst + 8), _mm256_blendv_epi8(AVX2_HI(lo, hi), bg1, AVX2_HI(zlo, zhi)));
+	}
+
+	blendBgScalar<32>(dst, bgimg, pixmap, w, fc, fpixel);
+}
+
+static SSE2 void fillSse2(u8 *dst, u32 size, u32 pattern, bool stream)
+{
+	u32 head = -(long)dst & 15;
+	if (head > size) head = size;
+	fillNone(dst, head, pattern, false);
+	dst += head, size -= head;
+
+	__m128i c = _mm_set1_epi32(pattern);
+	if (stream) {
+		for (; size >= 64; size -= 64, dst += 64) {
+			_mm_stream_si128((__m128i *)dst, c);
+			_mm_stream_si128((__m128i *)(dst + 16), c);
+			_mm_stream_si128((__m128i *)(dst + 32), c);
+			_mm_stream_si128((__m128i *)(dst + 48), c);
+		}
+		_mm_sfence();
+	}
+
+	for (; size >= 16; size -= 16, dst += 16) {
+		_mm_store_si128((__m128i *)dst, c);
+	}
+
+	fillNone(dst, size, pattern, false);
+}
+
+static SSE2 void fill24Sse2(u8 *dst, u32 size, u32 pattern, bool stream)
+{
+	// sixteen pixels make three whole vectors, which begin where the first aligned address falls
+	// into the pattern
+	u8 bytes[96];
+	for (u32 i = 0; i < sizeof(bytes); i += 3) {
+		bytes[i] = pattern;
+		bytes[i + 1] = pattern >> 8;
+		bytes[i + 2] = pattern >> 16;
+	}
+
+	u32 head = -(long)dst & 15;
+	if (head > size) head = size;
+	memcpy(dst, bytes, head);
+	dst += head, size -= head;
+
+	const u8 *phase = bytes + head;
+	__m128i c0 = _mm_loadu_si128((const __m128i *)phase);
+	__m128i c1 = _mm_loadu_si128((const __m128i *)(phase + 16));
+	__m128i c2 = _mm_loadu_si128((const __m128i *)(phase + 32));
+
+	if (stream) {
+		for (; size >= 48; size -= 48, dst += 48) {
+			_mm_stream_si128((__m128i *)dst, c0);
+			_mm_stream_si128((__m128i *)(dst + 16), c1);
+			_mm_stream_si128((__m128i *)(dst + 32), c2);
+		}
+		_mm_sfence();
+	}
+
+	for (; size >= 48; size -= 48, dst += 48) {
+		_mm_store_si128((__m128i *)dst, c0);
+		_mm_store_si128((__m128i *)(dst + 16), c1);
+		_mm_store_si128((__m128i *)(dst + 32), c2);
+	}
+
+	memcpy(dst, phase, size);
+}
+
+// 24 bpp is blended as 32 bpp a row at a time, then stored a pixel at a time as the scalar path does
+static BlendFun blend32;
+static BlendBgFun blend32Bg;
+
+static inline void pack24(u8 *dst, const u32 *line, u32 w)
+{
+	for (; w--; dst += 3, line++) {
+		*(volatile Pixel24 *)dst = *line;
+	}
+}
+
+static void blend24Simd(u8 *dst, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel)
+{
+	if (!w) return;
+
+	u32 line[w];
+	blend32((u8 *)line, pixmap, w, fc, bc, fpixel);
+	pack24(dst, line, w);
+}
+
+static void blend24BgSimd(u8 *dst, const u8 *bgimg, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel)
+{
+	if (!w) return;
+
+	u32 line[w], bg[w];
+	for (u32 i = 0; i < w; i++) {
+		bg[i] = ((const Pixel24 *)bgimg)[i];
+	}
+
+	blend32Bg((u8 *)line, (const u8 *)bg, pixmap, w, fc, fpixel);
+	pack24(dst, line, w);
+}
+
+static AVX2 void fillAvx2(u8 *dst, u32 size, u32 pattern, bool stream)
+{
+	u32 head = -(long)dst & 31;
+	if (head > size) head = size;
+	fillNone(dst, head, pattern, false);
+	dst += head, size -= head;
+
+	__m256i c = _mm256_set1_epi32(pattern);
+	if (stream) {
+		for (; size >= 128; size -= 128, dst += 128) {
+			_mm256_stream_si256((__m256i *)dst, c);
+			_mm256_stream_si256((__m256i *)(dst + 32), c);
+			_mm256_stream_si256((__m256i *)(dst + 64), c);
+			_mm256_stream_si256((__m256i *)(dst + 96), c);
+		}
+		_mm_sfence();
+	}
+
+	for (; size >= 32; size -= 32, dst += 32) {
+		_mm256_store_si256((__m256i *)dst, c);
+	}
+
+	// gcc leaves out vzeroupper before the tail call, and dirty upper halves slow down all sse code after
+	_mm256_zeroupper();
+	fillNone(dst, size, pattern, false);
+}
+
+#endif
+
+SimdType detectSimd()
+{
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return SimdAvx2;
+	if (__builtin_cpu_supports("sse2")) return SimdSse2;
+#endif
+	return SimdNone;
+}
+
+const s8 *simdName(SimdType type)
+{
+	static const s8 * const names[] = { "scalar", "sse2", "avx2" };
+	return names[type];
+}
+
+void defaultLayout(u32 bpp, PixelLayout &layout)
+{
+	static const PixelLayout rgb15 = { { 10, 5 }, { 5, 5 }, { 0, 5 } };
+	static const PixelLayout rgb16 = { { 11, 5 }, { 5, 6 }, { 0, 5 } };
+	static const PixelLayout rgb32 = { { 16, 8 }, { 8, 8 }, { 0, 8 } };
+
+	switch (bpp) {
+	case 15:
+		layout = rgb15;
+		break;
+	case 16:
+		layout = rgb16;
+		break;
+	case 24:
+	case 32:
+		layout = rgb32;
+		break;
+	default:
+		memset(&layout, 0, sizeof(layout));
+		break;
+	}
+}
+
+static bool sameField(const ColorField &a, const ColorField &b)
+{
+	return a.offset == b.offset && a.length == b.length;
+}
+
+LayoutType layoutType(u32 bpp, const PixelLayout &layout)
+{
+	PixelLayout rgb;
+	defaultLayout(bpp, rgb);
+
+	if (sameField(layout.green, rgb.green)) {
+		if (sameField(layout.red, rgb.red) && sameField(layout.blue, rgb.blue)) return LayoutRgb;
+		if (sameField(layout.red, rgb.blue) && sameField(layout.blue, rgb.red)) return LayoutBgr;
+	}
+
+	return LayoutOther;
+}
+
+bool getSimdKernels(SimdType type, u32 bpp, const PixelLayout &layout, SimdKernels &kernels)
+{
+	if (bpp == 8) return false;
+
+	if (layoutType(bpp, layout) == LayoutOther) {
+		if (type != SimdNone) return false;
+		otherLayout = layout;
+
+		switch (bpp) {
+		case 15:
+		case 16:
+			kernels.blend = blendNone<0, u16>;
+			kernels.blendBg = blendBgNone<0, u16>;
+			return true;
+		case 24:
+			kernels.blend = blendNone<0, Pixel24>;
+			kernels.blendBg = blendBgNone<0, Pixel24>;
+			return true;
+		case 32:
+			kernels.blend = blendNone<0, u32>;
+			kernels.blendBg = blendBgNone<0, u32>;
+			return true;
+		}
+
+		return false;
+	}
+
+	if (type == SimdNone) {
+		switch (bpp) {
+		case 15:
+			kernels.blend = blendNone<15, u16>;
+			kernels.blendBg = blendBgNone<15, u16>;
+			return true;
+		case 16:
+			kernels.blend = blendNone<16, u16>;
+			kernels.blendBg = blendBgNone<16, u16>;
+			return true;
+		case 24:
+			kernels.blend = blendNone<24, Pixel24>;
+			kernels.blendBg = blendBgNone<24, Pixel24>;
+			return true;
+		case 32:
+			kernels.blend = blendNone<32, u32>;
+			kernels.blendBg = blendBgNone<32, u32>;
+			return true;
+		}
+	}
+
+#ifdef SIMD_X86
+	#define KERNELS(bits, isa) \
+	case bits: \
+		kernels.blend = blend##bits##isa; \
+		kernels.blendBg = blend##bits##Bg##isa; \
+		return true;
+
+	if (type == SimdSse2) {
+		switch (bpp) {
+		KERNELS(15, Sse2)
+		KERNELS(16, Sse2)
+		KERNELS(32, Sse2)
+		}
+	} else if (type == SimdAvx2) {
+		switch (bpp) {
+		KERNELS(15, Avx2)
+		KERNELS(16, Avx2)
+		KERNELS(32, Avx2)
+		}
+	}
+
+	if (bpp == 24 && type != SimdNone && getSimdKernels(type, 32, layout, kernels)) {
+		blend32 = kernels.blend;
+		blend32Bg = kernels.blendBg;
+		kernels.blend = blend24Simd;
+		kernels.blendBg = blend24BgSimd;
+		return true;
+	}
+#endif
+	return false;
+}
+
+TransposeFun getTransposeKernel(SimdType type, u32 bpp)
+{
+#ifdef SIMD_X86
+	// avx2 gains nothing over sse2 here, the loads and stores dominate
+	if (type != SimdNone) {
+		switch (bpp) {
+		case 15:
+		case 16:
+			return transpose16Sse2;
+		case 32:
+			return transpose32Sse2;
+		}
+	}
+#endif
+
+	switch (bpp) {
+	case 8:
+		return transposeNone<u8>;
+	case 15:
+	case 16:
+		return transposeNone<u16>;
+	case 24:
+		return transposeNone<Pixel24>;
+	default:
+		return transposeNone<u32>;
+	}
+}
+
+FillFun getFillKernel(SimdType type, u32 bpp)
+{
+#ifdef SIMD_X86
+	// the pattern of 24 bpp repeats every 48 bytes, which sse2 registers hold best
+	if (bpp == 24 && type != SimdNone) return fill24Sse2;
+	if (type == SimdAvx2) return fillAvx2;
+	if (type == SimdSse2) return fillSse2;
+#endif
+	return (bpp == 24) ? fill24None : fillNone;
+}
@@ -0,0 +1,88 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef SCREEN_SIMD_H
+#define SCREEN_SIMD_H
+
+#include "screen.h"
+
+typedef enum { SimdNone = 0, SimdSse2, SimdAvx2 } SimdType;
+
+// the usual rgb order of a depth, the same with red and blue swapped, which is drawn by the same
+// kernels given colors with red and blue swapped, or anything else, left to the portable kernels
+typedef enum { LayoutRgb = 0, LayoutBgr, LayoutOther } LayoutType;
+
+void defaultLayout(u32 bpp, PixelLayout &layout);
+LayoutType layoutType(u32 bpp, const PixelLayout &layout);
+
+inline u32 packField(u8 value, const ColorField &field)
+{
+	u32 bits = (field.length <= 8) ? (value >> (8 - field.length)) : (value << (field.length - 8));
+	return bits << field.offset;
+}
+
+inline u8 unpackField(u32 pixel, const ColorField &field)
+{
+	u32 bits = (pixel >> field.offset) & ((1 << field.length) - 1);
+	return (field.length <= 8) ? (bits << (8 - field.length)) : (bits >> (field.length - 8));
+}
+
+// a pixel of 24 bpp, which has no integer type of its own
+struct Pixel24 {
+	u8 bytes[3];
+
+	operator u32() const {
+		return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+	}
+
+	void operator=(u32 color) volatile {
+		bytes[0] = color;
+		bytes[1] = color >> 8;
+		bytes[2] = color >> 16;
+	}
+};
+
+// blend a row of 8-bit coverage values between two palette colors
+typedef void (*BlendFun)(u8 *dst, const u8 *pixmap, u32 w, const Color &fc, const Color &bc, u32 fpixel);
+// same as above, but blend with the pixels of background image
+typedef void (*BlendBgFun)(u8 *dst, const u8 *bgimg, const u8 *pixmap, u32 w, const Color &fc, u32 fpixel);
+
+// pixel (x, y) of the w x h block at src goes to line x, column y of dst,
+// negative pitches walk the lines backwards
+typedef void (*TransposeFun)(u8 *dst, s32 dpitch, const u8 *src, s32 spitch, u32 w, u32 h);
+
+// fill size bytes with a 32-bit pattern of whole pixels, or a single pixel at 24 bpp, non-temporal
+// stores keep a large fill from evicting everything else in the cache
+typedef void (*FillFun)(u8 *dst, u32 size, u32 pattern, bool stream);
+
+struct SimdKernels {
+	BlendFun blend;
+	BlendBgFun blendBg;
+};
+
+SimdType detectSimd();
+const s8 *simdName(SimdType type);
+// SimdNone gives the portable kernels, which write through plain pointers and are the only ones
+// for LayoutOther
+bool getSimdKernels(SimdType type, u32 bpp, const PixelLayout &layout, SimdKernels &kernels);
+TransposeFun getTransposeKernel(SimdType type, u32 bpp);
+FillFun getFillKernel(SimdType type, u32 bpp);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ *   Copyright © 2008-2010 dragchan <zgchan317@gmail.com>
+ *   This file is part of FbTerm.
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include "screen.h"
+#include "font.h"
+#include "fbconfig.h"
+
+#define MAX_RENDER_THREADS 16
+
+// drawText() calls queued to be drawn by the render threads
+struct TextCmd {
+	u32 x, y;
+	u8 fc, bc;
+	u16 num;
+	u32 text;
+};
+
+static TextCmd *cmds;
+static u32 nrCmds, maxCmds;
+static u16 *cmdText;
+static bool *cmdDws;
+static u32 textLen, maxText;
+
+// render threads, the main thread draws the first band itself
+static u32 nrThreads = 1;
+static pthread_t threads[MAX_RENDER_THREADS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startCond = PTHREAD_COND_INITIALIZER, doneCond = PTHREAD_COND_INITIALIZER;
+static u32 generation, busyThreads;
+static bool quitThreads;
+
+void Screen::initThreads()
+{
+	mBatchRunning = false;
+
+	u32 num = 1;
+	Config::instance()->getOption("render-threads", num);
+	if (num > MAX_RENDER_THREADS) num = MAX_RENDER_THREADS;
+	if (num > mRows) num = mRows;
+	if (num <= 1) return;
+
+	maxCmds = mCols * mRows;
+	maxText = mCols * mRows * 2;
+	cmds = new TextCmd[maxCmds];
+	cmdText = new u16[maxText];
+	cmdDws = new bool[maxText];
+
+	// signals are left to the main thread, FbTerm reads them from a signalfd once it blocks them
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (nrThreads = 1; nrThreads < num; nrThreads++) {
+		if (pthread_create(&threads[nrThreads], 0, renderThread, (void *)(long)nrThreads)) break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+void Screen::endThreads()
+{
+	if (nrThreads <= 1) return;
+
+	pthread_mutex_lock(&lock);
+	quitThreads = true;
+	pthread_cond_broadcast(&startCond);
+	pthread_mutex_unlock(&lock);
+
+	for (u32 i = 1; i < nrThreads; i++) {
+		pthread_join(threads[i], 0);
+	}
+	nrThreads = 1;
+	quitThreads = false;
+	generation = 0;
+
+	delete[] cmds;
+	delete[] cmdText;
+	delete[] cmdDws;
+}
+
+u32 Screen::renderThreads()
+{
+	return nrThreads;
+}
+
+bool Screen::queueText(u32 x, u32 y, u8 fc, u8 bc, u16 num, u16 *text, bool *dw)
+{
+	if (nrThreads <= 1 || mBatchRunning) return false;
+
+	// every queued call must stay inside one row of cells, so that the bands never overlap
+	if (y % FH(1) || y >= mHeight) {
+		drawQueued();
+		return false;
+	}
+
+	if (nrCmds == maxCmds || textLen + num > maxText) drawQueued();
+	if (num > maxText) return false;
+
+	TextCmd &cmd = cmds[nrCmds++];
+	cmd.x = x;
+	cmd.y = y;
+	cmd.fc = fc;
+	cmd.bc = bc;
+	cmd.num = num;
+	cmd.text = textLen;
+
+	memcpy(cmdText + textLen, text, num * sizeof(u16));
+	memcpy(cmdDws + textLen, dw, num * sizeof(bool));
+	textLen += num;
+
+	u32 w = 0;
+	for (u16 i = 0; i < num; i++) {
+		// render threads only look up glyphs and blend tables which are made already
+		if (text[i] != 0x20) Font::instance()->getGlyph(text[i]);
+		w += dw[i] ? FW(2) : FW(1);
+	}
+	blendTable(fc, bc);
+
+	// a glyph may reach into the cell on its left
+	u32 left = (x > FW(1) ? x - FW(1) : 0);
+	damageRect(left, y, x + w - left, FH(1));
+
+	return true;
+}
+
+void Screen::drawQueued()
+{
+	if (!nrCmds || mBatchRunning) return;
+
+	// not worth waking the threads for a few cells
+	if (textLen < mCols * 2) {
+		// renderText() calls fillRect(), which must find the queue empty
+		u32 num = nrCmds;
+		nrCmds = 0;
+
+		for (u32 i = 0; i < num; i++) {
+			TextCmd &cmd = cmds[i];
+			renderText(cmd.x, cmd.y, cmd.fc, cmd.bc, cmd.num, cmdText + cmd.text, cmdDws + cmd.text);
+		}
+	} else {
+		mBatchRunning = true;
+
+		pthread_mutex_lock(&lock);
+		generation++;
+		busyThreads = nrThreads - 1;
+		pthread_cond_broadcast(&startCond);
+		pthread_mutex_unlock(&lock);
+
+		renderBand(0);
+
+		pthread_mutex_lock(&lock);
+		while (busyThreads) pthread_cond_wait(&doneCond, &lock);
+		pthread_mutex_unlock(&lock);
+
+		mBatchRunning = false;
+	}
+
+	nrCmds = 0;
+	textLen = 0;
+}
+
+void Screen::renderBand(u32 band)
+{
+	for (u32 i = 0; i < nrCmds; i++) {
+		TextCmd &cmd = cmds[i];
+
+		u32 row = cmd.y / FH(1);
+		if (row >= mRows) row = mRows - 1;
+		if (row * nrThreads / mRows != band) continue;
+
+		renderText(cmd.x, cmd.y, cmd.fc, cmd.bc, cmd.num, cmdText + cmd.text, cmdDws + cmd.text);
+	}
+}
+
+void *Screen::renderThread(void *arg)
+{
+	u32 band = (u32)(long)arg, seen = 0;
+
+	while (1) {
+		pthread_mutex_lock(&lock);
+		while (generation == seen && !quitThreads) pthread_cond_wait(&startCond, &lock);
+		seen = generation;
+		bool quit = quitThreads;
+		pthread_mutex_unlock(&lock);
+
+		if (quit) break;
+
+		Screen::instance()->renderBand(band);
+
+		pthread_mutex_lock(&lock);
+		if (!--busyThreads) pthread_cond_signal(&doneCond);
+		pthread_mutex_unlock(&lock);
+	}
+
+	return 0;
+}
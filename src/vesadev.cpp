@@ -170,6 +170,7 @@ static s16 get_mode(s16 mode, bool only_print)
                 break;
         case 15:
         case 16:
+        case 24:
         case 32:
                 if (minfo->memory_model != VBE_MODEL_RGB) continue;
                 break;
@@ -237,6 +238,15 @@ VesaDev::VesaDev()
 	mHeight = mode_info.y_resolution;
 	mBitsPerPixel = mode_info.bits_per_pixel;
 
+	if (mBitsPerPixel != 8) {
+		mLayout.red.offset = mode_info.red_field_position;
+		mLayout.red.length = mode_info.red_mask_size;
+		mLayout.green.offset = mode_info.green_field_position;
+		mLayout.green.length = mode_info.green_mask_size;
+		mLayout.blue.offset = mode_info.blue_field_position;
+		mLayout.blue.length = mode_info.blue_mask_size;
+	}
+
 	scanline_width = mWidth;
 	scanline_height = mHeight;
 }